@@ -35,8 +35,107 @@
 #include "anchorlayout.h"
 
 #include <QEvent>
+#include <QFile>
+#include <QJsonDocument>
 #include <QtDebug>
 
+#include <limits>
+
+/*
+ * Collects the geometries computed while anchor lines are being updated and
+ * applies them in one go when the outermost batch goes out of scope. Lines
+ * read geometries through the batch, so they see pending values before they
+ * are applied. Each widget is then touched at most once per update, instead
+ * of once per anchored edge.
+ */
+class AnchorGeometryBatch
+{
+public:
+    AnchorGeometryBatch();
+    ~AnchorGeometryBatch();
+
+    static QRect geometry(const QWidget *widget);
+    static void setGeometry(QWidget *widget, const QRect &geometry);
+
+private:
+    void commit();
+
+private:
+    static AnchorGeometryBatch *current;
+    bool m_active;
+    QList<QPointer<QWidget>> m_widgets;
+    QHash<const QWidget *, QRect> m_geometries;
+};
+
+AnchorGeometryBatch *AnchorGeometryBatch::current = nullptr;
+
+AnchorGeometryBatch::AnchorGeometryBatch() : m_active(current == nullptr)
+{
+    if (m_active)
+        current = this;
+}
+
+AnchorGeometryBatch::~AnchorGeometryBatch()
+{
+    if (!m_active)
+        return;
+
+    // Geometry changes made while committing send resize and move events,
+    // which must not end up in this batch.
+    current = nullptr;
+    this->commit();
+}
+
+QRect AnchorGeometryBatch::geometry(const QWidget *widget)
+{
+    if (current != nullptr) {
+        auto it = current->m_geometries.constFind(widget);
+        if (it != current->m_geometries.constEnd())
+            return it.value();
+    }
+
+    return widget->geometry();
+}
+
+void AnchorGeometryBatch::setGeometry(QWidget *widget, const QRect &geometry)
+{
+    if (current == nullptr) {
+        if (AnchorRecorder::current != nullptr)
+            AnchorRecorder::current->expectGeometry(widget, geometry);
+        widget->setGeometry(geometry);
+        return;
+    }
+
+    if (!current->m_geometries.contains(widget))
+        current->m_widgets.append(widget);
+    current->m_geometries.insert(widget, geometry);
+}
+
+void AnchorGeometryBatch::commit()
+{
+    // Each move or resize below marks the old and new rectangles of the
+    // widget dirty in its parent. Qt merges those and paints them together
+    // on the next pass of the event loop, so repaints need no batching here.
+    Q_FOREACH (const QPointer<QWidget> &widget, m_widgets) {
+        if (widget.isNull())
+            continue;
+
+        const QRect geometry = m_geometries.value(widget.data());
+        if (widget->geometry() == geometry)
+            continue;
+
+        // QWidget::move() places the frame of a window, not its contents,
+        // so windows always go through setGeometry().
+        if (AnchorRecorder::current != nullptr)
+            AnchorRecorder::current->expectGeometry(widget, geometry);
+        if (geometry.size() == widget->size() && !widget->isWindow())
+            widget->move(geometry.topLeft());
+        else
+            widget->setGeometry(geometry);
+    }
+}
+
+
 AnchorLayout *AnchorLayout::get(QWidget *widget)
 {
     if (widget == nullptr)
@@ -199,6 +298,8 @@ bool AnchorLayout::eventFilter(QObject *object, QEvent *event)
         switch (event->type()) {
         case QEvent::Move:
         case QEvent::Resize:
+            if (AnchorRecorder::current != nullptr)
+                AnchorRecorder::current->recordGeometry(m_widget);
             emit geometryChanged(m_widget->geometry());
             this->update();
             break;
@@ -217,6 +318,8 @@ void AnchorLayout::timerEvent(QTimerEvent *te)
 
     m_updateTimer.stop();
 
+    AnchorGeometryBatch batch;
+
     AnchorLine *lines[6] = { m_leftLine,   m_topLine,     m_rightLine,
                              m_bottomLine, m_vcenterLine, m_hcenterLine };
     for (int i = 0; i < 6; i++) {
@@ -281,6 +384,8 @@ AnchorLine::AnchorLine(AnchorLayout *layout, AnchorLine::Edge edge,
 
 AnchorLine::~AnchorLine()
 {
+    AnchorSolver::lineDestroyed(this);
+
     if (m_anchoredTo != nullptr)
         m_anchoredTo->removeFromUpdateList(this);
     m_anchoredTo = nullptr;
@@ -297,7 +402,9 @@ void AnchorLine::setOffset(int val)
         return;
 
     m_offset = val;
+    AnchorSolver::anchorChanged(this);
 
+    AnchorGeometryBatch batch;
     this->updateList();
 }
 
@@ -312,6 +419,7 @@ void AnchorLine::setOffsetDirection(int dir)
 
     m_offsetDirection = newdir;
 
+    AnchorGeometryBatch batch;
     this->updateList();
 }
 
@@ -329,6 +437,7 @@ AnchorLine *AnchorLine::anchorTo(AnchorLine *line)
     if (m_anchoredTo != nullptr) {
         m_anchoredTo->removeFromUpdateList(this);
         m_anchoredTo = nullptr;
+        AnchorSolver::anchorChanged(this);
     }
 
     if (line == nullptr)
@@ -343,6 +452,7 @@ AnchorLine *AnchorLine::anchorTo(AnchorLine *line)
 
     m_anchoredTo = line;
     m_anchoredTo->addToUpdateList(this);
+    AnchorSolver::anchorChanged(this);
     return this;
 }
 
@@ -370,60 +480,62 @@ void AnchorLine::update()
         if (m_anchoredTo == nullptr)
             return;
 
+        // Children of a container with an AnchorSolver are placed by it.
+        if (AnchorSolver::find(this->widget()->parentWidget()) != nullptr)
+            return;
+
         Relationship rel = relationship(this, m_anchoredTo);
         if (rel == NoRelationship)
             return;
 
         QWidget *w = this->widget();
-        QRect geo = w->geometry();
+        QRect geo = AnchorGeometryBatch::geometry(w);
 
-        const QLine anchorLine = (rel == SiblingRelationship)
-                ? m_anchoredTo->line(GeometryLine)
-                : m_anchoredTo->line(RectLine);
+        const int anchorPosition = (rel == SiblingRelationship)
+                ? m_anchoredTo->position(GeometryLine)
+                : m_anchoredTo->position(RectLine);
         switch (m_edge) {
         case LeftEdge: {
-            const int left = anchorLine.p1().x() + m_offsetDirection * m_offset;
+            const int left = anchorPosition + m_offsetDirection * m_offset;
             if (m_layout->right()->anchoredTo() == nullptr)
                 geo.moveLeft(left);
             else
                 geo.setLeft(left);
         } break;
         case TopEdge: {
-            const int top = anchorLine.p1().y() + m_offsetDirection * m_offset;
+            const int top = anchorPosition + m_offsetDirection * m_offset;
             if (m_layout->bottom()->anchoredTo() == nullptr)
                 geo.moveTop(top);
             else
                 geo.setTop(top);
         } break;
         case RightEdge: {
-            const int right =
-                    anchorLine.p1().x() + m_offsetDirection * m_offset;
+            const int right = anchorPosition + m_offsetDirection * m_offset;
             if (m_layout->left()->anchoredTo() == nullptr)
                 geo.moveRight(right);
             else
                 geo.setRight(right);
         } break;
         case BottomEdge: {
-            const int bottom =
-                    anchorLine.p1().y() + m_offsetDirection * m_offset;
+            const int bottom = anchorPosition + m_offsetDirection * m_offset;
             if (m_layout->top()->anchoredTo() == nullptr)
                 geo.moveBottom(bottom);
             else
                 geo.setBottom(bottom);
         } break;
         case HCenter: {
-            const int x = anchorLine.p1().x() + m_offsetDirection * m_offset;
+            const int x = anchorPosition + m_offsetDirection * m_offset;
             geo.moveCenter(QPoint(x, geo.center().y()));
         } break;
         case VCenter: {
-            const int y = anchorLine.p1().y() + m_offsetDirection * m_offset;
+            const int y = anchorPosition + m_offsetDirection * m_offset;
             geo.moveCenter(QPoint(geo.center().x(), y));
         } break;
         default:
             break;
         }
 
-        w->setGeometry(geo);
+        AnchorGeometryBatch::setGeometry(w, geo);
     };
 
     updateGeometry();
@@ -436,38 +548,35 @@ void AnchorLine::updateList()
         line->update();
 }
 
-QLine AnchorLine::line(LineMode mode) const
+int AnchorLine::position(LineMode mode) const
 {
-    const QRect rect = (mode == GeometryLine) ? m_layout->widget()->geometry()
-                                              : m_layout->widget()->rect();
+    // Matches the line that QRect, or QRectF for custom lines, would give,
+    // without building it.
+    const QRect geometry = AnchorGeometryBatch::geometry(m_layout->widget());
+    const QRect rect = (mode == GeometryLine)
+            ? geometry
+            : QRect(QPoint(0, 0), geometry.size());
+
     switch (m_edge) {
     case LeftEdge:
-        return QLine(rect.topLeft(), rect.bottomLeft());
+        return rect.left();
     case TopEdge:
-        return QLine(rect.topLeft(), rect.topRight());
+        return rect.top();
     case RightEdge:
-        return QLine(rect.topRight(), rect.bottomRight());
+        return rect.right();
     case BottomEdge:
-        return QLine(rect.bottomLeft(), rect.bottomRight());
+        return rect.bottom();
     case HCenter:
-        return QLine(rect.center().x(), rect.top(), rect.center().x(),
-                     rect.bottom());
+        return rect.center().x();
     case VCenter:
-        return QLine(rect.left(), rect.center().y(), rect.right(),
-                     rect.center().y());
-    case Horizontal: {
-        const QRectF rectf = rect;
-        const qreal y = rectf.top() + rectf.height() * m_percent;
-        return QLineF(rectf.left(), y, rectf.right(), y).toLine();
-    };
-    case Vertical: {
-        const QRectF rectf = rect;
-        const qreal x = rectf.left() + rectf.width() * m_percent;
-        return QLineF(x, rectf.top(), x, rectf.bottom()).toLine();
-    };
+        return rect.center().y();
+    case Horizontal:
+        return qRound(rect.top() + rect.height() * m_percent);
+    case Vertical:
+        return qRound(rect.left() + rect.width() * m_percent);
     }
 
-    return QLine();
+    return 0;
 }
 
 AnchorLine::Relationship AnchorLine::relationship(const AnchorLine *line1,
@@ -487,3 +596,1804 @@ AnchorLine::Relationship AnchorLine::relationship(const AnchorLine *line1,
 
     return NoRelationship;
 }
+
+///////////////////////////////////////////////////////////////////////////////
+
+static bool isVerticalEdge(AnchorLine::Edge edge)
+{
+    return edge == AnchorLine::LeftEdge || edge == AnchorLine::RightEdge
+            || edge == AnchorLine::HCenter || edge == AnchorLine::Vertical;
+}
+
+static bool isCustomEdge(AnchorLine::Edge edge)
+{
+    return edge == AnchorLine::Horizontal || edge == AnchorLine::Vertical;
+}
+
+AnchorGraph::AnchorGraph() { }
+
+AnchorGraph::~AnchorGraph() { }
+
+int AnchorGraph::addNode(int parentNode)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (parentNode >= 0 && !this->isValidNode(parentNode))
+        return -1;
+
+    Node node;
+    node.parent = parentNode < 0 ? -1 : parentNode;
+    node.margins = 0;
+    for (int i = 0; i < 6; i++)
+        node.lines[i] = -1;
+
+    m_nodes.append(node);
+    return m_nodes.size() - 1;
+}
+
+int AnchorGraph::nodeCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_nodes.size();
+}
+
+int AnchorGraph::parentNode(int node) const
+{
+    QMutexLocker locker(&m_mutex);
+    return this->isValidNode(node) ? m_nodes.at(node).parent : -1;
+}
+
+int AnchorGraph::left(int node)
+{
+    return this->edgeLine(node, AnchorLine::LeftEdge);
+}
+
+int AnchorGraph::top(int node)
+{
+    return this->edgeLine(node, AnchorLine::TopEdge);
+}
+
+int AnchorGraph::right(int node)
+{
+    return this->edgeLine(node, AnchorLine::RightEdge);
+}
+
+int AnchorGraph::bottom(int node)
+{
+    return this->edgeLine(node, AnchorLine::BottomEdge);
+}
+
+int AnchorGraph::horizontalCenter(int node)
+{
+    return this->edgeLine(node, AnchorLine::HCenter);
+}
+
+int AnchorGraph::verticalCenter(int node)
+{
+    return this->edgeLine(node, AnchorLine::VCenter);
+}
+
+int AnchorGraph::edgeLine(int node, AnchorLine::Edge edge)
+{
+    QMutexLocker locker(&m_mutex);
+    return this->fetchLine(node, edge);
+}
+
+int AnchorGraph::customLine(int node, Qt::Orientation orientation,
+                            qreal percent,
+                            AnchorLayout::OffsetDirection offsetDirection)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!this->isValidNode(node))
+        return -1;
+
+    const AnchorLine::Edge edge = (orientation == Qt::Horizontal)
+            ? AnchorLine::Horizontal
+            : AnchorLine::Vertical;
+    const int line = this->addLine(node, edge, percent);
+    if (offsetDirection == AnchorLayout::OD_Auto)
+        offsetDirection =
+                percent < 0 ? AnchorLayout::OD_Left : AnchorLayout::OD_Right;
+    m_lines[line].offsetDirection = offsetDirection;
+    return line;
+}
+
+void AnchorGraph::centerIn(int node, int other)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!this->isAnchorAllowed(node, other))
+        return;
+
+    const AnchorLine::Edge edges[4] = { AnchorLine::LeftEdge,
+                                        AnchorLine::TopEdge,
+                                        AnchorLine::RightEdge,
+                                        AnchorLine::BottomEdge };
+    for (int i = 0; i < 4; i++)
+        this->anchorLine(m_nodes.at(node).lines[edges[i]], -1);
+
+    this->anchorLine(this->fetchLine(node, AnchorLine::HCenter),
+                     this->fetchLine(other, AnchorLine::HCenter));
+    this->anchorLine(this->fetchLine(node, AnchorLine::VCenter),
+                     this->fetchLine(other, AnchorLine::VCenter));
+}
+
+int AnchorGraph::fill(int node, int other)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!this->isAnchorAllowed(node, other))
+        return node;
+
+    const AnchorLine::Edge edges[4] = { AnchorLine::LeftEdge,
+                                        AnchorLine::RightEdge,
+                                        AnchorLine::TopEdge,
+                                        AnchorLine::BottomEdge };
+    for (int i = 0; i < 4; i++)
+        this->anchorLine(this->fetchLine(node, edges[i]),
+                         this->fetchLine(other, edges[i]));
+
+    this->anchorLine(m_nodes.at(node).lines[AnchorLine::HCenter], -1);
+    this->anchorLine(m_nodes.at(node).lines[AnchorLine::VCenter], -1);
+
+    return node;
+}
+
+void AnchorGraph::setMargins(int node, int margin)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!this->isValidNode(node) || m_nodes.at(node).margins == margin)
+        return;
+
+    const AnchorLine::Edge edges[4] = { AnchorLine::LeftEdge,
+                                        AnchorLine::TopEdge,
+                                        AnchorLine::RightEdge,
+                                        AnchorLine::BottomEdge };
+    for (int i = 0; i < 4; i++) {
+        const int line = m_nodes.at(node).lines[edges[i]];
+        if (line >= 0)
+            m_lines[line].offset = margin;
+    }
+
+    m_nodes[node].margins = margin;
+}
+
+int AnchorGraph::anchorTo(int line, int toLine)
+{
+    QMutexLocker locker(&m_mutex);
+    this->anchorLine(line, toLine);
+    return line;
+}
+
+int AnchorGraph::anchoredTo(int line) const
+{
+    QMutexLocker locker(&m_mutex);
+    return this->isValidLine(line) ? m_lines.at(line).anchoredTo : -1;
+}
+
+void AnchorGraph::setOffset(int line, int val)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (this->isValidLine(line))
+        m_lines[line].offset = val;
+}
+
+void AnchorGraph::setOffsetDirection(int line, int dir)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!this->isValidLine(line) || !isCustomEdge(m_lines.at(line).edge))
+        return;
+
+    m_lines[line].offsetDirection = (dir < 0) ? -1 : 1;
+}
+
+bool AnchorGraph::attach(const QList<QWidget *> &widgets) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    // Validate everything up front, so that a mismatched widget list leaves
+    // the widgets untouched instead of half-wired.
+    if (widgets.size() != m_nodes.size())
+        return false;
+
+    QSet<QWidget *> attached;
+    QVector<AnchorLayout *> layouts(m_nodes.size());
+    for (int i = 0; i < m_nodes.size(); i++) {
+        QWidget *widget = widgets.at(i);
+        if (widget == nullptr || attached.contains(widget))
+            return false;
+
+        const int parent = m_nodes.at(i).parent;
+        if (parent >= 0 && widget->parentWidget() != widgets.at(parent))
+            return false;
+
+        layouts[i] = widget->findChild<AnchorLayout *>(
+                QString(), Qt::FindDirectChildrenOnly);
+        attached.insert(widget);
+    }
+
+    // Widgets may already have an AnchorLayout, like a page that has been
+    // filled into its window, and their existing lines are reused. Only
+    // anchoring a line that is already anchored, or attaching the graph to
+    // the same widgets again, is a conflict.
+    if (!m_nodes.isEmpty() && m_attached.contains(widgets.first()))
+        return false;
+
+    QVector<AnchorLine *> lines(m_lines.size());
+    for (int i = 0; i < m_lines.size(); i++) {
+        const Line &line = m_lines.at(i);
+        AnchorLayout *layout = layouts.at(line.node);
+        if (layout == nullptr || line.edge > AnchorLine::VCenter)
+            continue;
+
+        AnchorLine *const edgeLines[6] = { layout->m_leftLine,
+                                           layout->m_topLine,
+                                           layout->m_rightLine,
+                                           layout->m_bottomLine,
+                                           layout->m_hcenterLine,
+                                           layout->m_vcenterLine };
+        lines[i] = edgeLines[line.edge];
+        if (lines.at(i) != nullptr && line.anchoredTo >= 0
+            && lines.at(i)->m_anchoredTo != nullptr)
+            return false;
+    }
+
+    // The graph already holds unique, valid anchors, so layouts and lines
+    // are put together directly instead of through the public API. That
+    // way each layout is updated once, after everything is wired.
+    for (int i = 0; i < m_nodes.size(); i++) {
+        if (layouts.at(i) == nullptr) {
+            layouts[i] = new AnchorLayout(widgets.at(i));
+            layouts[i]->m_margins = m_nodes.at(i).margins;
+        }
+    }
+
+    for (int i = 0; i < m_lines.size(); i++) {
+        const Line &line = m_lines.at(i);
+        if (lines.at(i) != nullptr) {
+            // A reused line keeps its offset unless the graph anchors it.
+            if (line.anchoredTo >= 0) {
+                lines[i]->m_offset = line.offset;
+                lines[i]->m_offsetDirection = line.offsetDirection;
+            }
+            continue;
+        }
+
+        AnchorLayout *layout = layouts.at(line.node);
+        AnchorLine *newLine = new AnchorLine(layout, line.edge, line.percent);
+        newLine->m_offset = line.offset;
+        newLine->m_offsetDirection = line.offsetDirection;
+        lines[i] = newLine;
+
+        switch (line.edge) {
+        case AnchorLine::LeftEdge:
+            layout->m_leftLine = newLine;
+            break;
+        case AnchorLine::TopEdge:
+            layout->m_topLine = newLine;
+            break;
+        case AnchorLine::RightEdge:
+            layout->m_rightLine = newLine;
+            break;
+        case AnchorLine::BottomEdge:
+            layout->m_bottomLine = newLine;
+            break;
+        case AnchorLine::HCenter:
+            layout->m_hcenterLine = newLine;
+            break;
+        case AnchorLine::VCenter:
+            layout->m_vcenterLine = newLine;
+            break;
+        case AnchorLine::Horizontal:
+        case AnchorLine::Vertical:
+            layout->m_customLines.append(newLine);
+            break;
+        }
+    }
+
+    for (int i = 0; i < m_lines.size(); i++) {
+        const int anchoredTo = m_lines.at(i).anchoredTo;
+        if (anchoredTo < 0)
+            continue;
+
+        lines[i]->m_anchoredTo = lines.at(anchoredTo);
+        lines.at(anchoredTo)->m_updateList.append(lines.at(i));
+        AnchorSolver::anchorChanged(lines.at(i));
+    }
+
+    Q_FOREACH (AnchorLayout *layout, layouts)
+        layout->update();
+
+    if (!m_nodes.isEmpty()) {
+        m_attached.removeAll(QPointer<QWidget>());
+        m_attached.append(widgets.first());
+    }
+
+    return true;
+}
+
+bool AnchorGraph::isValidNode(int node) const
+{
+    return node >= 0 && node < m_nodes.size();
+}
+
+bool AnchorGraph::isValidLine(int line) const
+{
+    return line >= 0 && line < m_lines.size();
+}
+
+bool AnchorGraph::isAnchorAllowed(int node, int other) const
+{
+    if (!this->isValidNode(node) || !this->isValidNode(other))
+        return false;
+
+    const int parent = m_nodes.at(node).parent;
+    return (parent >= 0 && other == parent)
+            || m_nodes.at(other).parent == parent;
+}
+
+int AnchorGraph::fetchLine(int node, AnchorLine::Edge edge)
+{
+    if (!this->isValidNode(node) || isCustomEdge(edge))
+        return -1;
+
+    int line = m_nodes.at(node).lines[edge];
+    if (line < 0) {
+        line = this->addLine(node, edge, 0);
+        m_lines[line].offset = m_nodes.at(node).margins;
+        m_nodes[node].lines[edge] = line;
+    }
+
+    return line;
+}
+
+int AnchorGraph::addLine(int node, AnchorLine::Edge edge, qreal percent)
+{
+    Line line;
+    line.node = node;
+    line.edge = edge;
+    line.percent = percent;
+    line.offset = 0;
+    line.anchoredTo = -1;
+
+    switch (edge) {
+    case AnchorLine::RightEdge:
+    case AnchorLine::BottomEdge:
+        line.offsetDirection = -1;
+        break;
+    default:
+        line.offsetDirection = 1;
+    }
+
+    m_lines.append(line);
+    return m_lines.size() - 1;
+}
+
+void AnchorGraph::anchorLine(int line, int toLine)
+{
+    // Mirrors the checks in AnchorLine::anchorTo(), so that attach() never
+    // has to reject an anchor that was accepted here.
+    if (!this->isValidLine(line))
+        return;
+
+    Line &from = m_lines[line];
+    if (isCustomEdge(from.edge))
+        return;
+
+    if (!this->isValidLine(toLine)) {
+        from.anchoredTo = -1;
+        return;
+    }
+
+    const Line &to = m_lines.at(toLine);
+    if (from.node == to.node)
+        return;
+
+    from.anchoredTo = -1;
+    if (isVerticalEdge(from.edge) != isVerticalEdge(to.edge))
+        return;
+
+    from.anchoredTo = toLine;
+}
+
+QJsonObject AnchorGraph::toJson() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    QJsonArray nodes;
+    Q_FOREACH (const Node &node, m_nodes) {
+        QJsonObject item;
+        item.insert("parent", node.parent);
+        item.insert("margins", node.margins);
+        nodes.append(item);
+    }
+
+    QJsonArray lines;
+    Q_FOREACH (const Line &line, m_lines) {
+        QJsonObject item;
+        item.insert("node", line.node);
+        item.insert("edge", int(line.edge));
+        item.insert("percent", line.percent);
+        item.insert("offset", line.offset);
+        item.insert("offsetDirection", line.offsetDirection);
+        item.insert("anchoredTo", line.anchoredTo);
+        lines.append(item);
+    }
+
+    QJsonObject json;
+    json.insert("nodes", nodes);
+    json.insert("lines", lines);
+    return json;
+}
+
+bool AnchorGraph::fromJson(const QJsonObject &json)
+{
+    QMutexLocker locker(&m_mutex);
+
+    const QJsonArray nodes = json.value("nodes").toArray();
+    const QJsonArray lines = json.value("lines").toArray();
+
+    QVector<Node> oldNodes;
+    QVector<Line> oldLines;
+    oldNodes.swap(m_nodes);
+    oldLines.swap(m_lines);
+
+    // Nodes must come after their parents, just like addNode() requires.
+    bool ok = true;
+    for (int i = 0; ok && i < nodes.size(); i++) {
+        const QJsonObject item = nodes.at(i).toObject();
+        const int parent = item.value("parent").toInt(-1);
+        ok = parent < i;
+
+        Node node;
+        node.parent = parent < 0 ? -1 : parent;
+        node.margins = item.value("margins").toInt();
+        for (int j = 0; j < 6; j++)
+            node.lines[j] = -1;
+        m_nodes.append(node);
+    }
+
+    for (int i = 0; ok && i < lines.size(); i++) {
+        const QJsonObject item = lines.at(i).toObject();
+        const int node = item.value("node").toInt(-1);
+        const int edge = item.value("edge").toInt(-1);
+        ok = this->isValidNode(node) && edge >= AnchorLine::LeftEdge
+                && edge <= AnchorLine::Vertical;
+        if (!ok)
+            break;
+
+        const int line = this->addLine(node, AnchorLine::Edge(edge),
+                                       item.value("percent").toDouble());
+        m_lines[line].offset = item.value("offset").toInt();
+        if (isCustomEdge(AnchorLine::Edge(edge))) {
+            m_lines[line].offsetDirection =
+                    item.value("offsetDirection").toInt() < 0 ? -1 : 1;
+        } else {
+            ok = m_nodes.at(node).lines[edge] < 0;
+            m_nodes[node].lines[edge] = line;
+        }
+    }
+
+    for (int i = 0; ok && i < m_lines.size(); i++) {
+        const int anchoredTo = lines.at(i).toObject().value("anchoredTo").toInt(
+                -1);
+        this->anchorLine(i, anchoredTo);
+        ok = m_lines.at(i).anchoredTo == anchoredTo;
+    }
+
+    if (!ok) {
+        m_nodes.swap(oldNodes);
+        m_lines.swap(oldLines);
+    }
+
+    return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static QJsonArray rectToJson(const QRect &rect)
+{
+    QJsonArray json;
+    json.append(rect.x());
+    json.append(rect.y());
+    json.append(rect.width());
+    json.append(rect.height());
+    return json;
+}
+
+AnchorRecorder *AnchorRecorder::current = nullptr;
+
+AnchorRecorder::AnchorRecorder(QWidget *root) : m_root(root) { }
+
+AnchorRecorder::~AnchorRecorder()
+{
+    this->stop();
+}
+
+bool AnchorRecorder::start()
+{
+    if (m_root.isNull() || (current != nullptr && current != this))
+        return false;
+
+    // Every widget that has an AnchorLayout becomes a node, along with the
+    // widgets between it and the root, so that parent-child relationships
+    // survive the replay. Nodes are ordered breadth first, which puts each
+    // parent before its children.
+    QList<AnchorLayout *> layouts =
+            m_root->findChildren<AnchorLayout *>(QString());
+    QHash<const QWidget *, AnchorLayout *> layoutOf;
+    QHash<const QWidget *, bool> needed;
+    needed.insert(m_root.data(), true);
+    Q_FOREACH (AnchorLayout *layout, layouts) {
+        layoutOf.insert(layout->widget(), layout);
+        QWidget *widget = layout->widget();
+        while (widget != nullptr && !needed.contains(widget)) {
+            needed.insert(widget, true);
+            widget = widget->parentWidget();
+        }
+    }
+
+    QList<QWidget *> widgets;
+    widgets.append(m_root.data());
+    for (int i = 0; i < widgets.size(); i++) {
+        const QList<QWidget *> children =
+                widgets.at(i)->findChildren<QWidget *>(
+                        QString(), Qt::FindDirectChildrenOnly);
+        Q_FOREACH (QWidget *child, children) {
+            if (needed.contains(child))
+                widgets.append(child);
+        }
+    }
+
+    // Solver constraints are not part of the trace, so a replay could not
+    // reproduce the geometry of widgets that an AnchorSolver places.
+    for (int i = 1; i < widgets.size(); i++) {
+        if (AnchorSolver::find(widgets.at(i)->parentWidget()) != nullptr) {
+            qWarning() << "AnchorRecorder: cannot record" << widgets.at(i)
+                       << "while an AnchorSolver places it";
+            return false;
+        }
+    }
+
+    AnchorGraph graph;
+    m_nodes.clear();
+    m_geometries.clear();
+    m_initialGeometries = QJsonArray();
+    m_events = QJsonArray();
+    for (int i = 0; i < widgets.size(); i++) {
+        QWidget *widget = widgets.at(i);
+        const int parent =
+                (i == 0) ? -1 : m_nodes.value(widget->parentWidget());
+        m_nodes.insert(widget, graph.addNode(parent));
+        m_geometries.append(widget->geometry());
+        m_initialGeometries.append(rectToJson(widget->geometry()));
+    }
+
+    QHash<const AnchorLine *, int> lineHandles;
+    for (int i = 0; i < widgets.size(); i++) {
+        AnchorLayout *layout = layoutOf.value(widgets.at(i));
+        if (layout == nullptr)
+            continue;
+
+        graph.setMargins(i, layout->m_margins);
+
+        QList<AnchorLine *> lines;
+        lines << layout->m_leftLine << layout->m_topLine
+              << layout->m_rightLine << layout->m_bottomLine
+              << layout->m_hcenterLine << layout->m_vcenterLine;
+        lines += layout->m_customLines;
+        Q_FOREACH (AnchorLine *line, lines) {
+            if (line == nullptr)
+                continue;
+
+            int handle = -1;
+            if (isCustomEdge(line->edge())) {
+                handle = graph.customLine(
+                        i,
+                        line->edge() == AnchorLine::Horizontal ? Qt::Horizontal
+                                                               : Qt::Vertical,
+                        line->m_percent,
+                        AnchorLayout::OffsetDirection(line->offsetDirection()));
+            } else {
+                handle = graph.edgeLine(i, line->edge());
+            }
+            graph.setOffset(handle, line->offset());
+            lineHandles.insert(line, handle);
+        }
+    }
+
+    // Anchors to lines outside the root are left out; the geometry changes
+    // they cause are recorded as external changes instead.
+    for (auto it = lineHandles.constBegin(); it != lineHandles.constEnd();
+         ++it) {
+        const AnchorLine *anchoredTo = it.key()->anchoredTo();
+        if (anchoredTo != nullptr && lineHandles.contains(anchoredTo))
+            graph.anchorTo(it.value(), lineHandles.value(anchoredTo));
+    }
+
+    m_graph = graph.toJson();
+    m_clock.start();
+    current = this;
+    return true;
+}
+
+void AnchorRecorder::stop()
+{
+    if (current == this)
+        current = nullptr;
+}
+
+bool AnchorRecorder::save(const QString &fileName) const
+{
+    QJsonObject json;
+    json.insert("graph", m_graph);
+    json.insert("geometries", m_initialGeometries);
+    json.insert("events", m_events);
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    return file.write(QJsonDocument(json).toJson(QJsonDocument::Compact)) >= 0;
+}
+
+void AnchorRecorder::expectGeometry(const QWidget *widget,
+                                    const QRect &geometry)
+{
+    // The root is only ever placed by anchors outside the trace, so its
+    // changes are recorded as external ones even when an anchor made them.
+    const int node = m_nodes.value(widget, -1);
+    if (node > 0)
+        m_geometries[node] = geometry;
+}
+
+void AnchorRecorder::recordGeometry(const QWidget *widget)
+{
+    const int node = m_nodes.value(widget, -1);
+    if (node < 0)
+        return;
+
+    // Geometries applied by anchor lines were announced in expectGeometry(),
+    // and a single setGeometry() call can send both a move and a resize
+    // event, so only changes to the last known geometry are recorded.
+    const QRect geometry = widget->geometry();
+    if (m_geometries.at(node) == geometry)
+        return;
+
+    m_geometries[node] = geometry;
+
+    QJsonObject event;
+    event.insert("time", m_clock.elapsed());
+    event.insert("node", node);
+    event.insert("geometry", rectToJson(geometry));
+    m_events.append(event);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * An incremental simplex solver for linear equalities and inequalities with
+ * strengths, following the Cassowary algorithm as implemented by Kiwi.
+ * Variables, slack, error and dummy variables are all symbols, identified by
+ * an int; index 0 is reserved for "no symbol". Every row expresses one basic
+ * symbol in terms of parametric ones.
+ */
+static const qreal requiredStrength = 1001001000.0;
+
+class AnchorLinearSolver
+{
+public:
+    AnchorLinearSolver();
+
+    int addVariable();
+    qreal value(int variable) const;
+
+    int addConstraint(const QMap<int, qreal> &terms, qreal constant,
+                      AnchorSolver::Relation relation, qreal strength);
+    bool removeConstraint(int constraint);
+
+    bool addEditVariable(int variable, qreal strength);
+    bool removeEditVariable(int variable);
+    bool suggestValue(int variable, qreal value);
+
+private:
+    enum SymbolType { InvalidSymbol, ExternalSymbol, SlackSymbol, ErrorSymbol,
+                      DummySymbol };
+
+    struct Row
+    {
+        Row(qreal value = 0.0) : constant(value) { }
+
+        qreal add(qreal value) { return constant += value; }
+        void insert(int symbol, qreal coefficient = 1.0);
+        void insert(const Row &other, qreal coefficient = 1.0);
+        void reverseSign();
+        void solveFor(int symbol);
+        void solveFor(int lhs, int rhs);
+        void substitute(int symbol, const Row &row);
+        qreal coefficientFor(int symbol) const
+        {
+            return cells.value(symbol, 0.0);
+        }
+
+        qreal constant;
+        QMap<int, qreal> cells;
+    };
+
+    struct Tag
+    {
+        int marker;
+        int other;
+    };
+
+    struct Constraint
+    {
+        Tag tag;
+        qreal strength;
+    };
+
+    struct Edit
+    {
+        int constraint;
+        qreal constant;
+    };
+
+    int newSymbol(SymbolType type);
+    SymbolType symbolType(int symbol) const { return m_symbolTypes.at(symbol); }
+    bool isRestricted(int symbol) const
+    {
+        return symbolType(symbol) == SlackSymbol
+                || symbolType(symbol) == ErrorSymbol;
+    }
+
+    Row createRow(const QMap<int, qreal> &terms, qreal constant,
+                  AnchorSolver::Relation relation, qreal strength, Tag *tag);
+    int chooseSubject(const Row &row, const Tag &tag) const;
+    bool allDummies(const Row &row) const;
+    bool addWithArtificialVariable(const Row &row);
+    void substitute(int symbol, const Row &row);
+    bool optimize(const Row *objective);
+    bool dualOptimize();
+    int enteringSymbol(const Row &objective) const;
+    int dualEnteringSymbol(const Row &row) const;
+    int pivotableSymbol(const Row &row) const;
+    int leavingSymbol(int entering) const;
+    int markerLeavingSymbol(int marker) const;
+    void removeMarkerEffects(int marker, qreal strength);
+
+private:
+    QVector<SymbolType> m_symbolTypes;
+    QMap<int, Row> m_rows;
+    QHash<int, Constraint> m_constraints;
+    QHash<int, Edit> m_edits;
+    QVector<int> m_infeasibleRows;
+    Row m_objective;
+    Row m_artificial;
+    bool m_hasArtificial;
+    int m_nextConstraint;
+};
+
+static bool nearZero(qreal value)
+{
+    return qAbs(value) < 1.0e-8;
+}
+
+void AnchorLinearSolver::Row::insert(int symbol, qreal coefficient)
+{
+    const qreal value = cells.value(symbol, 0.0) + coefficient;
+    if (nearZero(value))
+        cells.remove(symbol);
+    else
+        cells.insert(symbol, value);
+}
+
+void AnchorLinearSolver::Row::insert(const Row &other, qreal coefficient)
+{
+    constant += other.constant * coefficient;
+    for (auto it = other.cells.constBegin(); it != other.cells.constEnd(); ++it)
+        this->insert(it.key(), it.value() * coefficient);
+}
+
+void AnchorLinearSolver::Row::reverseSign()
+{
+    constant = -constant;
+    for (auto it = cells.begin(); it != cells.end(); ++it)
+        it.value() = -it.value();
+}
+
+void AnchorLinearSolver::Row::solveFor(int symbol)
+{
+    const qreal coefficient = -1.0 / cells.take(symbol);
+    constant *= coefficient;
+    for (auto it = cells.begin(); it != cells.end(); ++it)
+        it.value() *= coefficient;
+}
+
+void AnchorLinearSolver::Row::solveFor(int lhs, int rhs)
+{
+    this->insert(lhs, -1.0);
+    this->solveFor(rhs);
+}
+
+void AnchorLinearSolver::Row::substitute(int symbol, const Row &row)
+{
+    auto it = cells.find(symbol);
+    if (it == cells.end())
+        return;
+
+    const qreal coefficient = it.value();
+    cells.erase(it);
+    this->insert(row, coefficient);
+}
+
+AnchorLinearSolver::AnchorLinearSolver()
+    : m_hasArtificial(false), m_nextConstraint(0)
+{
+    m_symbolTypes.append(InvalidSymbol);
+}
+
+int AnchorLinearSolver::addVariable()
+{
+    return this->newSymbol(ExternalSymbol);
+}
+
+qreal AnchorLinearSolver::value(int variable) const
+{
+    auto it = m_rows.constFind(variable);
+    return it == m_rows.constEnd() ? 0.0 : it.value().constant;
+}
+
+int AnchorLinearSolver::addConstraint(const QMap<int, qreal> &terms,
+                                      qreal constant,
+                                      AnchorSolver::Relation relation,
+                                      qreal strength)
+{
+    Tag tag;
+    Row row = this->createRow(terms, constant, relation, strength, &tag);
+
+    // Rows whose only symbols are dummies can only be satisfied if their
+    // constant already is zero, in which case the dummy becomes basic.
+    int subject = this->chooseSubject(row, tag);
+    if (subject == 0 && this->allDummies(row)) {
+        if (!nearZero(row.constant))
+            return -1;
+        subject = tag.marker;
+    }
+
+    if (subject == 0) {
+        if (!this->addWithArtificialVariable(row)) {
+            // The row may have become basic before failing; take it out
+            // again so that the tableau is left as it was.
+            const int constraint = m_nextConstraint++;
+            m_constraints.insert(constraint, Constraint { tag, strength });
+            this->removeConstraint(constraint);
+            return -1;
+        }
+    } else {
+        row.solveFor(subject);
+        this->substitute(subject, row);
+        m_rows.insert(subject, row);
+    }
+
+    const int constraint = m_nextConstraint++;
+    m_constraints.insert(constraint, Constraint { tag, strength });
+    this->optimize(&m_objective);
+    return constraint;
+}
+
+bool AnchorLinearSolver::removeConstraint(int constraint)
+{
+    auto it = m_constraints.find(constraint);
+    if (it == m_constraints.end())
+        return false;
+
+    const Constraint info = it.value();
+    m_constraints.erase(it);
+
+    if (symbolType(info.tag.marker) == ErrorSymbol)
+        this->removeMarkerEffects(info.tag.marker, info.strength);
+    if (info.tag.other != 0 && symbolType(info.tag.other) == ErrorSymbol)
+        this->removeMarkerEffects(info.tag.other, info.strength);
+
+    // If the marker is basic, its row can simply be dropped. Otherwise it
+    // is pivoted into the basis first.
+    if (!m_rows.remove(info.tag.marker)) {
+        const int leaving = this->markerLeavingSymbol(info.tag.marker);
+        if (leaving == 0)
+            return false;
+
+        Row row = m_rows.take(leaving);
+        row.solveFor(leaving, info.tag.marker);
+        this->substitute(info.tag.marker, row);
+    }
+
+    this->optimize(&m_objective);
+    return true;
+}
+
+bool AnchorLinearSolver::addEditVariable(int variable, qreal strength)
+{
+    if (m_edits.contains(variable) || strength >= requiredStrength)
+        return false;
+
+    QMap<int, qreal> terms;
+    terms.insert(variable, 1.0);
+    const int constraint =
+            this->addConstraint(terms, 0.0, AnchorSolver::Equal, strength);
+    if (constraint < 0)
+        return false;
+
+    m_edits.insert(variable, Edit { constraint, 0.0 });
+    return true;
+}
+
+bool AnchorLinearSolver::removeEditVariable(int variable)
+{
+    auto it = m_edits.find(variable);
+    if (it == m_edits.end())
+        return false;
+
+    const int constraint = it.value().constraint;
+    m_edits.erase(it);
+    return this->removeConstraint(constraint);
+}
+
+bool AnchorLinearSolver::suggestValue(int variable, qreal value)
+{
+    auto it = m_edits.find(variable);
+    if (it == m_edits.end())
+        return false;
+
+    const qreal delta = value - it.value().constant;
+    if (delta == 0.0)
+        return true;
+
+    it.value().constant = value;
+    const Tag tag = m_constraints.value(it.value().constraint).tag;
+
+    // Only the constants of the rows that depend on the edit constraint's
+    // error variables change, after which the dual simplex restores
+    // feasibility. This is what makes suggestions cheap.
+    auto row = m_rows.find(tag.marker);
+    if (row != m_rows.end()) {
+        if (row.value().add(-delta) < 0.0)
+            m_infeasibleRows.append(tag.marker);
+        return this->dualOptimize();
+    }
+
+    row = m_rows.find(tag.other);
+    if (row != m_rows.end()) {
+        if (row.value().add(delta) < 0.0)
+            m_infeasibleRows.append(tag.other);
+        return this->dualOptimize();
+    }
+
+    for (row = m_rows.begin(); row != m_rows.end(); ++row) {
+        const qreal coefficient = row.value().coefficientFor(tag.marker);
+        if (coefficient != 0.0 && row.value().add(delta * coefficient) < 0.0
+            && symbolType(row.key()) != ExternalSymbol)
+            m_infeasibleRows.append(row.key());
+    }
+
+    return this->dualOptimize();
+}
+
+int AnchorLinearSolver::newSymbol(SymbolType type)
+{
+    m_symbolTypes.append(type);
+    return m_symbolTypes.size() - 1;
+}
+
+AnchorLinearSolver::Row
+AnchorLinearSolver::createRow(const QMap<int, qreal> &terms, qreal constant,
+                              AnchorSolver::Relation relation, qreal strength,
+                              Tag *tag)
+{
+    Row row(constant);
+    for (auto it = terms.constBegin(); it != terms.constEnd(); ++it) {
+        if (nearZero(it.value()))
+            continue;
+
+        auto basic = m_rows.constFind(it.key());
+        if (basic != m_rows.constEnd())
+            row.insert(basic.value(), it.value());
+        else
+            row.insert(it.key(), it.value());
+    }
+
+    tag->marker = 0;
+    tag->other = 0;
+    switch (relation) {
+    case AnchorSolver::LessOrEqual:
+    case AnchorSolver::GreaterOrEqual: {
+        const qreal coefficient =
+                (relation == AnchorSolver::LessOrEqual) ? 1.0 : -1.0;
+        tag->marker = this->newSymbol(SlackSymbol);
+        row.insert(tag->marker, coefficient);
+        if (strength < requiredStrength) {
+            tag->other = this->newSymbol(ErrorSymbol);
+            row.insert(tag->other, -coefficient);
+            m_objective.insert(tag->other, strength);
+        }
+    } break;
+    case AnchorSolver::Equal:
+        if (strength < requiredStrength) {
+            tag->marker = this->newSymbol(ErrorSymbol);
+            tag->other = this->newSymbol(ErrorSymbol);
+            row.insert(tag->marker, -1.0);
+            row.insert(tag->other, 1.0);
+            m_objective.insert(tag->marker, strength);
+            m_objective.insert(tag->other, strength);
+        } else {
+            tag->marker = this->newSymbol(DummySymbol);
+            row.insert(tag->marker);
+        }
+        break;
+    }
+
+    if (row.constant < 0.0)
+        row.reverseSign();
+
+    return row;
+}
+
+int AnchorLinearSolver::chooseSubject(const Row &row, const Tag &tag) const
+{
+    for (auto it = row.cells.constBegin(); it != row.cells.constEnd(); ++it) {
+        if (symbolType(it.key()) == ExternalSymbol)
+            return it.key();
+    }
+
+    if (this->isRestricted(tag.marker) && row.coefficientFor(tag.marker) < 0.0)
+        return tag.marker;
+
+    if (tag.other != 0 && this->isRestricted(tag.other)
+        && row.coefficientFor(tag.other) < 0.0)
+        return tag.other;
+
+    return 0;
+}
+
+bool AnchorLinearSolver::allDummies(const Row &row) const
+{
+    for (auto it = row.cells.constBegin(); it != row.cells.constEnd(); ++it) {
+        if (symbolType(it.key()) != DummySymbol)
+            return false;
+    }
+
+    return true;
+}
+
+bool AnchorLinearSolver::addWithArtificialVariable(const Row &row)
+{
+    // Minimize an artificial variable that stands for the row; the row can
+    // be satisfied if the minimum is zero.
+    const int artificial = this->newSymbol(SlackSymbol);
+    m_rows.insert(artificial, row);
+    m_artificial = row;
+    m_hasArtificial = true;
+
+    this->optimize(&m_artificial);
+    const bool success = nearZero(m_artificial.constant);
+    m_hasArtificial = false;
+
+    auto it = m_rows.find(artificial);
+    if (it != m_rows.end()) {
+        Row basic = it.value();
+        m_rows.erase(it);
+        if (basic.cells.isEmpty())
+            return success;
+
+        const int entering = this->pivotableSymbol(basic);
+        if (entering == 0)
+            return false;
+
+        basic.solveFor(artificial, entering);
+        this->substitute(entering, basic);
+        m_rows.insert(entering, basic);
+    }
+
+    for (auto it = m_rows.begin(); it != m_rows.end(); ++it)
+        it.value().cells.remove(artificial);
+    m_objective.cells.remove(artificial);
+    return success;
+}
+
+void AnchorLinearSolver::substitute(int symbol, const Row &row)
+{
+    for (auto it = m_rows.begin(); it != m_rows.end(); ++it) {
+        it.value().substitute(symbol, row);
+        if (symbolType(it.key()) != ExternalSymbol
+            && it.value().constant < 0.0)
+            m_infeasibleRows.append(it.key());
+    }
+
+    m_objective.substitute(symbol, row);
+    if (m_hasArtificial)
+        m_artificial.substitute(symbol, row);
+}
+
+bool AnchorLinearSolver::optimize(const Row *objective)
+{
+    forever {
+        const int entering = this->enteringSymbol(*objective);
+        if (entering == 0)
+            return true;
+
+        const int leaving = this->leavingSymbol(entering);
+        if (leaving == 0)
+            return false; // the objective is unbounded
+
+        Row row = m_rows.take(leaving);
+        row.solveFor(leaving, entering);
+        this->substitute(entering, row);
+        m_rows.insert(entering, row);
+    }
+}
+
+bool AnchorLinearSolver::dualOptimize()
+{
+    while (!m_infeasibleRows.isEmpty()) {
+        const int leaving = m_infeasibleRows.takeLast();
+        auto it = m_rows.find(leaving);
+        if (it == m_rows.end() || nearZero(it.value().constant)
+            || it.value().constant >= 0.0)
+            continue;
+
+        const int entering = this->dualEnteringSymbol(it.value());
+        if (entering == 0)
+            return false;
+
+        Row row = it.value();
+        m_rows.erase(it);
+        row.solveFor(leaving, entering);
+        this->substitute(entering, row);
+        m_rows.insert(entering, row);
+    }
+
+    return true;
+}
+
+int AnchorLinearSolver::enteringSymbol(const Row &objective) const
+{
+    for (auto it = objective.cells.constBegin();
+         it != objective.cells.constEnd(); ++it) {
+        if (symbolType(it.key()) != DummySymbol && it.value() < 0.0)
+            return it.key();
+    }
+
+    return 0;
+}
+
+int AnchorLinearSolver::dualEnteringSymbol(const Row &row) const
+{
+    int entering = 0;
+    qreal ratio = std::numeric_limits<qreal>::max();
+    for (auto it = row.cells.constBegin(); it != row.cells.constEnd(); ++it) {
+        if (it.value() > 0.0 && symbolType(it.key()) != DummySymbol) {
+            const qreal r = m_objective.coefficientFor(it.key()) / it.value();
+            if (r < ratio) {
+                ratio = r;
+                entering = it.key();
+            }
+        }
+    }
+
+    return entering;
+}
+
+int AnchorLinearSolver::pivotableSymbol(const Row &row) const
+{
+    for (auto it = row.cells.constBegin(); it != row.cells.constEnd(); ++it) {
+        if (this->isRestricted(it.key()))
+            return it.key();
+    }
+
+    return 0;
+}
+
+int AnchorLinearSolver::leavingSymbol(int entering) const
+{
+    int leaving = 0;
+    qreal ratio = std::numeric_limits<qreal>::max();
+    for (auto it = m_rows.constBegin(); it != m_rows.constEnd(); ++it) {
+        if (symbolType(it.key()) == ExternalSymbol)
+            continue;
+
+        const qreal coefficient = it.value().coefficientFor(entering);
+        if (coefficient < 0.0) {
+            const qreal r = -it.value().constant / coefficient;
+            if (r < ratio) {
+                ratio = r;
+                leaving = it.key();
+            }
+        }
+    }
+
+    return leaving;
+}
+
+int AnchorLinearSolver::markerLeavingSymbol(int marker) const
+{
+    qreal ratio1 = std::numeric_limits<qreal>::max();
+    qreal ratio2 = std::numeric_limits<qreal>::max();
+    int first = 0;
+    int second = 0;
+    int third = 0;
+    for (auto it = m_rows.constBegin(); it != m_rows.constEnd(); ++it) {
+        const qreal coefficient = it.value().coefficientFor(marker);
+        if (coefficient == 0.0)
+            continue;
+
+        if (symbolType(it.key()) == ExternalSymbol) {
+            third = it.key();
+        } else if (coefficient < 0.0) {
+            const qreal r = -it.value().constant / coefficient;
+            if (r < ratio1) {
+                ratio1 = r;
+                first = it.key();
+            }
+        } else {
+            const qreal r = it.value().constant / coefficient;
+            if (r < ratio2) {
+                ratio2 = r;
+                second = it.key();
+            }
+        }
+    }
+
+    if (first != 0)
+        return first;
+    return second != 0 ? second : third;
+}
+
+void AnchorLinearSolver::removeMarkerEffects(int marker, qreal strength)
+{
+    if (marker == 0 || symbolType(marker) != ErrorSymbol)
+        return;
+
+    auto it = m_rows.constFind(marker);
+    if (it != m_rows.constEnd())
+        m_objective.insert(it.value(), -strength);
+    else
+        m_objective.insert(marker, -strength);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Stays keep widgets at their current geometry where nothing else decides
+// it. They are weaker than any user constraint, and sizes stay before
+// positions, so a widget anchored on one edge moves instead of resizing.
+static const qreal positionStayStrength = 0.25;
+static const qreal sizeStayStrength = 0.5;
+static const qreal containerStrength = 1.0e9;
+
+static qreal strengthWeight(AnchorSolver::Strength strength)
+{
+    switch (strength) {
+    case AnchorSolver::Weak:
+        return 1.0;
+    case AnchorSolver::Medium:
+        return 1.0e3;
+    case AnchorSolver::Strong:
+        return 1.0e6;
+    case AnchorSolver::Required:
+        break;
+    }
+
+    return requiredStrength;
+}
+
+static QHash<const QWidget *, AnchorSolver *> anchorSolvers;
+
+AnchorSolver *AnchorSolver::get(QWidget *container)
+{
+    if (container == nullptr)
+        return nullptr;
+
+    AnchorSolver *solver = AnchorSolver::find(container);
+    if (solver == nullptr)
+        solver = new AnchorSolver(container);
+
+    return solver;
+}
+
+AnchorSolver *AnchorSolver::find(const QWidget *container)
+{
+    if (container == nullptr || anchorSolvers.isEmpty())
+        return nullptr;
+
+    return anchorSolvers.value(container);
+}
+
+AnchorSolver::AnchorSolver(QWidget *container)
+    : QObject(container),
+      m_container(container),
+      m_solver(new AnchorLinearSolver)
+{
+    anchorSolvers.insert(container, this);
+    container->installEventFilter(this);
+
+    m_width = m_solver->addVariable();
+    m_height = m_solver->addVariable();
+    m_solver->addEditVariable(m_width, containerStrength);
+    m_solver->addEditVariable(m_height, containerStrength);
+    m_solver->suggestValue(m_width, container->width());
+    m_solver->suggestValue(m_height, container->height());
+
+    // Take over anchors that were set up before the solver existed.
+    this->syncAnchors(nullptr);
+    this->update();
+}
+
+AnchorSolver::~AnchorSolver()
+{
+    anchorSolvers.remove(m_container);
+    delete m_solver;
+}
+
+int AnchorSolver::addConstraint(AnchorLine *line, Relation relation,
+                                AnchorLine *other, int offset,
+                                Strength strength)
+{
+    QList<Term> terms;
+    terms.append(Term { line, 1.0 });
+    terms.append(Term { other, -1.0 });
+    return this->addConstraint(terms, relation, offset, strength);
+}
+
+int AnchorSolver::addConstraint(const QList<Term> &terms, Relation relation,
+                                qreal constant, Strength strength)
+{
+    QMap<int, qreal> expression;
+    qreal expressionConstant = -constant;
+    QList<const QObject *> widgets;
+    QList<QWidget *> added;
+    Q_FOREACH (const Term &term, terms) {
+        if (term.line == nullptr
+            || !this->addLineTerms(&expression, &expressionConstant, term.line,
+                                   term.coefficient, &added)) {
+            this->removeItems(added);
+            return -1;
+        }
+
+        if (term.line->widget() != m_container)
+            widgets.append(term.line->widget());
+    }
+
+    const int constraint =
+            m_solver->addConstraint(expression, expressionConstant, relation,
+                                    strengthWeight(strength));
+    if (constraint < 0) {
+        this->removeItems(added);
+        return -1;
+    }
+
+    m_constraints.insert(constraint, widgets);
+    this->update();
+    return constraint;
+}
+
+bool AnchorSolver::removeConstraint(int constraint)
+{
+    if (!m_constraints.remove(constraint))
+        return false;
+
+    m_solver->removeConstraint(constraint);
+    this->retryAnchors();
+    this->update();
+    return true;
+}
+
+bool AnchorSolver::beginEdit(AnchorLine *line, Strength strength)
+{
+    if (line == nullptr || strength == Required || m_edits.contains(line))
+        return false;
+
+    // The line's position is tied to a variable of its own, which is what
+    // gets edited.
+    QMap<int, qreal> terms;
+    qreal constant = 0;
+    QList<QWidget *> added;
+    if (!this->addLineTerms(&terms, &constant, line, 1.0, &added)) {
+        this->removeItems(added);
+        return false;
+    }
+
+    const int variable = m_solver->addVariable();
+    terms.insert(variable, -1.0);
+    const int constraint = m_solver->addConstraint(terms, constant, Equal,
+                                                   requiredStrength);
+    if (constraint < 0) {
+        this->removeItems(added);
+        return false;
+    }
+
+    const qreal position = m_solver->value(variable);
+    m_solver->addEditVariable(variable, strengthWeight(strength));
+    m_solver->suggestValue(variable, position);
+
+    const QObject *widget = line->widget();
+    m_edits.insert(line, Edit { widget, variable, constraint });
+    return true;
+}
+
+bool AnchorSolver::suggestPosition(AnchorLine *line, int position)
+{
+    auto it = m_edits.constFind(line);
+    if (it == m_edits.constEnd())
+        return false;
+
+    if (!m_solver->suggestValue(it.value().variable, position))
+        return false;
+
+    this->apply();
+    return true;
+}
+
+void AnchorSolver::endEdit(AnchorLine *line)
+{
+    auto it = m_edits.find(line);
+    if (it == m_edits.end())
+        return;
+
+    // Widgets stay where the edit left them, because apply() has already
+    // moved the stays there.
+    const Edit edit = it.value();
+    m_edits.erase(it);
+    m_solver->removeEditVariable(edit.variable);
+    m_solver->removeConstraint(edit.constraint);
+    this->update();
+}
+
+void AnchorSolver::update()
+{
+    m_updateTimer.start(0, this);
+}
+
+bool AnchorSolver::eventFilter(QObject *object, QEvent *event)
+{
+    if (object == m_container) {
+        switch (event->type()) {
+        case QEvent::Resize:
+            m_solver->suggestValue(m_width, m_container->width());
+            m_solver->suggestValue(m_height, m_container->height());
+            this->update();
+            break;
+        case QEvent::ChildAdded:
+            this->syncAnchors(static_cast<QChildEvent *>(event)->child());
+            break;
+        case QEvent::ChildRemoved: {
+            const QObject *child = static_cast<QChildEvent *>(event)->child();
+            this->removePendingAnchors(child);
+            this->removeItem(child);
+            this->retryAnchors();
+            break;
+        }
+        default:
+            break;
+        }
+    } else if (event->type() == QEvent::Move
+               || event->type() == QEvent::Resize) {
+        // Geometry changes that the solver did not make become the new
+        // stays of the widget.
+        auto it = m_items.constFind(object);
+        if (it != m_items.constEnd()
+            && it.value().widget->geometry() != m_applied.value(object)) {
+            this->suggestGeometry(it.value().widget,
+                                  it.value().widget->geometry());
+            this->update();
+        }
+    }
+
+    return false;
+}
+
+void AnchorSolver::timerEvent(QTimerEvent *te)
+{
+    if (m_updateTimer.timerId() != te->timerId())
+        return;
+
+    this->apply();
+}
+
+void AnchorSolver::apply()
+{
+    m_updateTimer.stop();
+
+    AnchorGeometryBatch batch;
+    for (auto it = m_items.constBegin(); it != m_items.constEnd(); ++it) {
+        const Item &item = it.value();
+        const QRect geometry(qRound(m_solver->value(item.x)),
+                             qRound(m_solver->value(item.y)),
+                             qMax(qRound(m_solver->value(item.width)), 0),
+                             qMax(qRound(m_solver->value(item.height)), 0));
+        m_applied.insert(item.widget, geometry);
+        AnchorGeometryBatch::setGeometry(item.widget, geometry);
+    }
+
+    // The stays follow the solution, so that widgets keep their current
+    // geometry when a constraint that placed them goes away. This is done
+    // once all values are read, because every suggestion updates them.
+    // Only widgets whose geometry changed cost anything here.
+    for (auto it = m_items.constBegin(); it != m_items.constEnd(); ++it)
+        this->suggestGeometry(it.value().widget, m_applied.value(it.key()));
+}
+
+bool AnchorSolver::addItem(QWidget *widget, QList<QWidget *> *added)
+{
+    if (m_items.contains(widget))
+        return true;
+
+    if (widget->parentWidget() != m_container)
+        return false;
+
+    Item item;
+    item.widget = widget;
+    item.x = m_solver->addVariable();
+    item.y = m_solver->addVariable();
+    item.width = m_solver->addVariable();
+    item.height = m_solver->addVariable();
+    m_solver->addEditVariable(item.x, positionStayStrength);
+    m_solver->addEditVariable(item.y, positionStayStrength);
+    m_solver->addEditVariable(item.width, sizeStayStrength);
+    m_solver->addEditVariable(item.height, sizeStayStrength);
+    m_items.insert(widget, item);
+
+    this->suggestGeometry(widget, widget->geometry());
+    widget->installEventFilter(this);
+    if (added != nullptr)
+        added->append(widget);
+    return true;
+}
+
+void AnchorSolver::removeItem(const QObject *widget)
+{
+    auto it = m_items.find(widget);
+    if (it == m_items.end())
+        return;
+
+    const Item item = it.value();
+    m_items.erase(it);
+    m_applied.remove(widget);
+
+    for (auto anchor = m_anchors.begin(); anchor != m_anchors.end();) {
+        if (anchor.value().widget == widget
+            || anchor.value().target == widget) {
+            m_solver->removeConstraint(anchor.value().constraint);
+            anchor = m_anchors.erase(anchor);
+        } else {
+            ++anchor;
+        }
+    }
+
+    for (auto edit = m_edits.begin(); edit != m_edits.end();) {
+        if (edit.value().widget == widget) {
+            m_solver->removeEditVariable(edit.value().variable);
+            m_solver->removeConstraint(edit.value().constraint);
+            edit = m_edits.erase(edit);
+        } else {
+            ++edit;
+        }
+    }
+
+    for (auto constraint = m_constraints.begin();
+         constraint != m_constraints.end();) {
+        if (constraint.value().contains(widget)) {
+            m_solver->removeConstraint(constraint.key());
+            constraint = m_constraints.erase(constraint);
+        } else {
+            ++constraint;
+        }
+    }
+
+    m_solver->removeEditVariable(item.x);
+    m_solver->removeEditVariable(item.y);
+    m_solver->removeEditVariable(item.width);
+    m_solver->removeEditVariable(item.height);
+    item.widget->removeEventFilter(this);
+    this->update();
+}
+
+void AnchorSolver::removeItems(const QList<QWidget *> &widgets)
+{
+    // Undoes the items that a failed constraint brought in, so that they do
+    // not stay behind with their stays and event filter.
+    Q_FOREACH (QWidget *widget, widgets)
+        this->removeItem(widget);
+}
+
+void AnchorSolver::removePendingAnchors(const QObject *widget)
+{
+    // Rejected anchors from or to a widget that leaves the container go too.
+    // They come back if the widget returns.
+    const QList<const AnchorLine *> pending = m_pendingAnchors.values();
+    Q_FOREACH (const AnchorLine *line, pending) {
+        if (line->widget() == widget || line->anchoredTo() == nullptr
+            || line->anchoredTo()->widget() == widget)
+            m_pendingAnchors.remove(line);
+    }
+}
+
+void AnchorSolver::suggestGeometry(const QWidget *widget,
+                                   const QRect &geometry)
+{
+    auto it = m_items.find(widget);
+    if (it == m_items.end() || it.value().stay == geometry)
+        return;
+
+    Item &item = it.value();
+    item.stay = geometry;
+    m_solver->suggestValue(item.x, geometry.x());
+    m_solver->suggestValue(item.y, geometry.y());
+    m_solver->suggestValue(item.width, geometry.width());
+    m_solver->suggestValue(item.height, geometry.height());
+}
+
+bool AnchorSolver::addLineTerms(QMap<int, qreal> *terms, qreal *constant,
+                                const AnchorLine *line, qreal coefficient,
+                                QList<QWidget *> *added)
+{
+    // A line sits at origin + factor * extent + bias, which matches QRect's
+    // left, center and right for edges, and the percent for custom lines.
+    qreal factor = 0.0;
+    qreal bias = 0.0;
+    switch (line->edge()) {
+    case AnchorLine::LeftEdge:
+    case AnchorLine::TopEdge:
+        break;
+    case AnchorLine::HCenter:
+    case AnchorLine::VCenter:
+        factor = 0.5;
+        bias = -0.5;
+        break;
+    case AnchorLine::RightEdge:
+    case AnchorLine::BottomEdge:
+        factor = 1.0;
+        bias = -1.0;
+        break;
+    case AnchorLine::Horizontal:
+    case AnchorLine::Vertical:
+        factor = line->m_percent;
+        break;
+    }
+
+    const bool horizontal = line->isVerticalLine();
+    QWidget *widget = line->widget();
+    if (widget == m_container) {
+        // Children see the container's lines in its own coordinates.
+        (*terms)[horizontal ? m_width : m_height] += coefficient * factor;
+        *constant += coefficient * bias;
+        return true;
+    }
+
+    if (!this->addItem(widget, added))
+        return false;
+
+    const Item item = m_items.value(widget);
+    (*terms)[horizontal ? item.x : item.y] += coefficient;
+    (*terms)[horizontal ? item.width : item.height] += coefficient * factor;
+    *constant += coefficient * bias;
+    return true;
+}
+
+void AnchorSolver::syncAnchor(AnchorLine *line)
+{
+    this->placeAnchor(line);
+
+    // Changing an anchor can make room for anchors that were rejected.
+    this->retryAnchors();
+}
+
+void AnchorSolver::placeAnchor(const AnchorLine *line)
+{
+    auto it = m_anchors.find(line);
+    const bool hadAnchor = it != m_anchors.end();
+    if (hadAnchor) {
+        m_solver->removeConstraint(it.value().constraint);
+        m_anchors.erase(it);
+    }
+
+    const bool wasPending = m_pendingAnchors.remove(line);
+
+    // Same relationships as AnchorLine::relationship(): the anchor must be
+    // to a sibling or to the container.
+    AnchorLine *target = line->anchoredTo();
+    if (target != nullptr && line->widget()->parentWidget() == m_container
+        && (target->widget() == m_container
+            || target->widget()->parentWidget() == m_container)) {
+        QMap<int, qreal> terms;
+        qreal constant = -line->m_offsetDirection * line->m_offset;
+        QList<QWidget *> added;
+        int constraint = -1;
+        if (this->addLineTerms(&terms, &constant, line, 1.0, &added)
+            && this->addLineTerms(&terms, &constant, target, -1.0, &added))
+            constraint = m_solver->addConstraint(terms, constant, Equal,
+                                                 requiredStrength);
+
+        // An anchor that conflicts with required constraints is kept aside
+        // and tried again whenever constraints or anchors change.
+        if (constraint >= 0) {
+            m_anchors.insert(line,
+                             Anchor { line->widget(), target->widget(),
+                                      constraint });
+        } else {
+            this->removeItems(added);
+            m_pendingAnchors.insert(line);
+            if (!wasPending)
+                qWarning() << "AnchorSolver: cannot honour the anchor of"
+                           << line->widget() << "to" << target->widget()
+                           << "while it conflicts with required constraints";
+        }
+    } else if (!hadAnchor && !wasPending) {
+        return;
+    }
+
+    this->update();
+}
+
+void AnchorSolver::retryAnchors()
+{
+    const QList<const AnchorLine *> pending = m_pendingAnchors.values();
+    Q_FOREACH (const AnchorLine *line, pending)
+        this->placeAnchor(line);
+}
+
+void AnchorSolver::syncAnchors(const QObject *widget)
+{
+    // Syncs the anchors of children that are from or to the given child, or
+    // all of them if none is given.
+    const QList<QWidget *> children = m_container->findChildren<QWidget *>(
+            QString(), Qt::FindDirectChildrenOnly);
+    Q_FOREACH (QWidget *child, children) {
+        AnchorLayout *layout = child->findChild<AnchorLayout *>(
+                QString(), Qt::FindDirectChildrenOnly);
+        if (layout == nullptr)
+            continue;
+
+        AnchorLine *lines[6] = { layout->m_leftLine,    layout->m_topLine,
+                                 layout->m_rightLine,   layout->m_bottomLine,
+                                 layout->m_hcenterLine, layout->m_vcenterLine };
+        for (int i = 0; i < 6; i++) {
+            if (lines[i] == nullptr || lines[i]->anchoredTo() == nullptr)
+                continue;
+
+            if (widget == nullptr || child == widget
+                || lines[i]->anchoredTo()->widget() == widget)
+                this->syncAnchor(lines[i]);
+        }
+    }
+}
+
+void AnchorSolver::anchorChanged(AnchorLine *line)
+{
+    AnchorSolver *solver = AnchorSolver::find(line->widget()->parentWidget());
+    if (solver != nullptr)
+        solver->syncAnchor(line);
+}
+
+void AnchorSolver::lineDestroyed(const AnchorLine *line)
+{
+    Q_FOREACH (AnchorSolver *solver, anchorSolvers) {
+        solver->m_pendingAnchors.remove(line);
+
+        auto anchor = solver->m_anchors.find(line);
+        if (anchor != solver->m_anchors.end()) {
+            solver->m_solver->removeConstraint(anchor.value().constraint);
+            solver->m_anchors.erase(anchor);
+            solver->retryAnchors();
+            solver->update();
+        }
+
+        auto edit = solver->m_edits.find(line);
+        if (edit != solver->m_edits.end()) {
+            solver->m_solver->removeEditVariable(edit.value().variable);
+            solver->m_solver->removeConstraint(edit.value().constraint);
+            solver->m_edits.erase(edit);
+        }
+    }
+}
@@ -36,7 +36,16 @@
 #define ANCHORLAYOUT_H
 
 #include <QBasicTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QMap>
+#include <QMutex>
 #include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QVector>
 #include <QWidget>
 
 class AnchorLine;
@@ -87,6 +96,9 @@ private:
 
 private:
     friend class AnchorLine;
+    friend class AnchorGraph;
+    friend class AnchorRecorder;
+    friend class AnchorSolver;
     QWidget *m_widget;
     int m_margins;
 
@@ -158,7 +170,7 @@ private:
     void updateList();
 
     enum LineMode { GeometryLine, RectLine };
-    QLine line(LineMode mode = GeometryLine) const;
+    int position(LineMode mode = GeometryLine) const;
 
     enum Relationship {
         NoRelationship,
@@ -170,6 +182,9 @@ private:
 
 private:
     friend class AnchorLayout;
+    friend class AnchorGraph;
+    friend class AnchorRecorder;
+    friend class AnchorSolver;
     AnchorLayout *m_layout;
     Edge m_edge;
     qreal m_percent;
@@ -179,4 +194,240 @@ private:
     AnchorLine *m_anchoredTo;
 };
 
+/*
+ * AnchorGraph records anchors between widgets that may not exist yet. Nodes
+ * stand in for widgets and lines stand in for their anchor lines; both are
+ * referred to by the integer handles returned when they are created. All
+ * building functions are thread-safe, so a graph can be put together on a
+ * worker thread. attach() then wires the recorded anchors onto real widgets,
+ * and must be called from the thread that the widgets live in. Widgets that
+ * already have an AnchorLayout keep it, and their existing lines are reused;
+ * attach() refuses to anchor a line that is already anchored, and to attach
+ * the graph to the same widgets twice.
+ */
+class AnchorGraph
+{
+public:
+    AnchorGraph();
+    ~AnchorGraph();
+
+    int addNode(int parentNode = -1);
+    int nodeCount() const;
+    int parentNode(int node) const;
+
+    int left(int node);
+    int top(int node);
+    int right(int node);
+    int bottom(int node);
+    int horizontalCenter(int node);
+    int verticalCenter(int node);
+    int edgeLine(int node, AnchorLine::Edge edge);
+    int customLine(int node, Qt::Orientation orientation, qreal percent,
+                   AnchorLayout::OffsetDirection offsetDirection =
+                           AnchorLayout::OD_Auto);
+
+    void centerIn(int node, int other);
+    int fill(int node, int other);
+
+    void setMargins(int node, int margin);
+
+    int anchorTo(int line, int toLine);
+    int anchoredTo(int line) const;
+
+    void setMargin(int line, int val) { this->setOffset(line, val); }
+    void setOffset(int line, int val);
+    void setOffsetDirection(int line, int dir);
+
+    bool attach(const QList<QWidget *> &widgets) const;
+
+    QJsonObject toJson() const;
+    bool fromJson(const QJsonObject &json);
+
+private:
+    Q_DISABLE_COPY(AnchorGraph)
+
+    struct Node
+    {
+        int parent;
+        int margins;
+        int lines[6];
+    };
+
+    struct Line
+    {
+        int node;
+        AnchorLine::Edge edge;
+        qreal percent;
+        int offset;
+        int offsetDirection;
+        int anchoredTo;
+    };
+
+    bool isValidNode(int node) const;
+    bool isValidLine(int line) const;
+    bool isAnchorAllowed(int node, int other) const;
+    int fetchLine(int node, AnchorLine::Edge edge);
+    int addLine(int node, AnchorLine::Edge edge, qreal percent);
+    void anchorLine(int line, int toLine);
+
+private:
+    mutable QMutex m_mutex;
+    QVector<Node> m_nodes;
+    QVector<Line> m_lines;
+    mutable QList<QPointer<QWidget>> m_attached;
+};
+
+/*
+ * AnchorRecorder captures the anchor graph below a root widget, along with
+ * every geometry change within it that was not made by an AnchorLayout, and
+ * saves them as a trace that tools/anchorreplay can replay headlessly. Only
+ * one recorder can be recording at a time.
+ *
+ * The graph is captured when start() is called and is not updated while
+ * recording. Anchors added or changed afterwards, and widgets created
+ * afterwards along with their geometry changes, are left out of the trace.
+ * Calling start() again captures the graph afresh and starts a new trace.
+ *
+ * AnchorSolver constraints are not part of the trace either, so start()
+ * refuses to record when a widget below the root has a parent with an
+ * AnchorSolver. Solvers set up after start() are not detected.
+ */
+class AnchorRecorder
+{
+public:
+    AnchorRecorder(QWidget *root);
+    ~AnchorRecorder();
+
+    QWidget *root() const { return m_root; }
+
+    bool start();
+    void stop();
+    bool isRecording() const { return current == this; }
+
+    bool save(const QString &fileName) const;
+
+private:
+    Q_DISABLE_COPY(AnchorRecorder)
+    friend class AnchorLayout;
+    friend class AnchorGeometryBatch;
+    void expectGeometry(const QWidget *widget, const QRect &geometry);
+    void recordGeometry(const QWidget *widget);
+
+private:
+    static AnchorRecorder *current;
+    QPointer<QWidget> m_root;
+    QHash<const QWidget *, int> m_nodes;
+    QVector<QRect> m_geometries;
+    QJsonObject m_graph;
+    QJsonArray m_initialGeometries;
+    QJsonArray m_events;
+    QElapsedTimer m_clock;
+};
+
+/*
+ * AnchorSolver places the children of a container by solving linear
+ * constraints instead of propagating anchor lines one by one. Anchors set
+ * up with anchorTo() and setOffset() become required equalities. On top of
+ * those, constraints can be equalities or inequalities over any lines of the
+ * container and its children, each with a strength. Constraints and
+ * container resizes are solved incrementally, and beginEdit() and
+ * suggestPosition() offer a fast path for interactive edits like dragging a
+ * splitter.
+ */
+class AnchorLinearSolver;
+class AnchorSolver : public QObject
+{
+    Q_OBJECT
+
+public:
+    static AnchorSolver *get(QWidget *container);
+    static AnchorSolver *find(const QWidget *container);
+
+    AnchorSolver(QWidget *container);
+    ~AnchorSolver();
+
+    QWidget *container() const { return m_container; }
+
+    enum Strength { Weak, Medium, Strong, Required };
+    enum Relation { LessOrEqual, Equal, GreaterOrEqual };
+
+    struct Term
+    {
+        AnchorLine *line;
+        qreal coefficient;
+    };
+
+    int addConstraint(AnchorLine *line, Relation relation, AnchorLine *other,
+                      int offset = 0, Strength strength = Required);
+    int addConstraint(const QList<Term> &terms, Relation relation,
+                      qreal constant, Strength strength = Required);
+    bool removeConstraint(int constraint);
+
+    bool beginEdit(AnchorLine *line, Strength strength = Strong);
+    bool suggestPosition(AnchorLine *line, int position);
+    void endEdit(AnchorLine *line);
+
+    void update();
+
+private:
+    bool eventFilter(QObject *object, QEvent *event);
+    void timerEvent(QTimerEvent *te);
+    void apply();
+    bool addItem(QWidget *widget, QList<QWidget *> *added = nullptr);
+    void removeItem(const QObject *widget);
+    void removeItems(const QList<QWidget *> &widgets);
+    void removePendingAnchors(const QObject *widget);
+    void suggestGeometry(const QWidget *widget, const QRect &geometry);
+    bool addLineTerms(QMap<int, qreal> *terms, qreal *constant,
+                      const AnchorLine *line, qreal coefficient,
+                      QList<QWidget *> *added);
+    void syncAnchor(AnchorLine *line);
+    void syncAnchors(const QObject *widget);
+    void placeAnchor(const AnchorLine *line);
+    void retryAnchors();
+
+    static void anchorChanged(AnchorLine *line);
+    static void lineDestroyed(const AnchorLine *line);
+
+private:
+    friend class AnchorLine;
+    friend class AnchorGraph;
+    QWidget *m_container;
+    AnchorLinearSolver *m_solver;
+    int m_width;
+    int m_height;
+
+    struct Item
+    {
+        QWidget *widget;
+        int x;
+        int y;
+        int width;
+        int height;
+        QRect stay;
+    };
+    QHash<const QObject *, Item> m_items;
+    QHash<const QObject *, QRect> m_applied;
+
+    struct Anchor
+    {
+        const QObject *widget;
+        const QObject *target;
+        int constraint;
+    };
+    QHash<const AnchorLine *, Anchor> m_anchors;
+    QSet<const AnchorLine *> m_pendingAnchors;
+
+    struct Edit
+    {
+        const QObject *widget;
+        int variable;
+        int constraint;
+    };
+    QHash<const AnchorLine *, Edit> m_edits;
+
+    QHash<int, QList<const QObject *>> m_constraints;
+    QBasicTimer m_updateTimer;
+};
+
 #endif // ANCHORLAYOUT_H
@@ -0,0 +1,257 @@
+/****************************************************************************
+**
+** Copyright 2020, Prashanth N Udupa <prashanth.udupa@gmail.com>
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain this copyright
+** notice, this list of conditions and the following disclaimer.
+**
+** 2. Redistributions in binary form must reproduce this copyright
+** notice, this list of conditions and the following disclaimer in the
+** documentation and/or other materials provided with the distribution.
+**
+** 3. Neither the name of the copyright holder nor the names of its
+** contributors may be used to endorse or promote products derived from
+** this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+** CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+** INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+** ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+** EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+****************************************************************************/
+
+#include "anchorlayout.h"
+#include <QtTest>
+#include <QtWidgets>
+
+class TestAnchorGraph : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void jsonRoundTrip();
+    void attachMatchesHandWired();
+    void attachRejectsMismatchedWidgets();
+    void attachReusesExistingLayouts();
+    void attachRejectsConflicts();
+    void fromJsonRejectsInvalidGraphs_data();
+    void fromJsonRejectsInvalidGraphs();
+};
+
+// The page from the README: a header across the top tenth of the page, and
+// a body filling the rest, 5 pixels below the header.
+static void buildPage(AnchorGraph *graph)
+{
+    const int page = graph->addNode();
+    const int header = graph->addNode(page);
+    const int body = graph->addNode(page);
+
+    graph->anchorTo(graph->left(header), graph->left(page));
+    graph->anchorTo(graph->right(header), graph->right(page));
+    graph->anchorTo(graph->top(header), graph->top(page));
+    graph->anchorTo(graph->bottom(header),
+                    graph->customLine(page, Qt::Horizontal, 0.1));
+
+    graph->fill(body, page);
+    graph->setMargin(graph->anchorTo(graph->top(body), graph->bottom(header)),
+                     5);
+}
+
+static QList<QWidget *> createPage(QWidget *parent)
+{
+    QWidget *page = new QWidget(parent);
+    return QList<QWidget *>()
+            << page << new QWidget(page) << new QWidget(page);
+}
+
+static bool hasAnchorLayout(const QWidget *widget)
+{
+    return widget->findChild<AnchorLayout *>(QString(),
+                                             Qt::FindDirectChildrenOnly)
+            != nullptr;
+}
+
+void TestAnchorGraph::jsonRoundTrip()
+{
+    AnchorGraph graph;
+    buildPage(&graph);
+    graph.setMargins(0, 3);
+    graph.setOffsetDirection(graph.customLine(0, Qt::Vertical, 0.5), -1);
+    const QJsonObject json = graph.toJson();
+
+    AnchorGraph copy;
+    QVERIFY(copy.fromJson(json));
+    QCOMPARE(copy.toJson(), json);
+    QCOMPARE(copy.nodeCount(), graph.nodeCount());
+    for (int i = 0; i < graph.nodeCount(); i++)
+        QCOMPARE(copy.parentNode(i), graph.parentNode(i));
+}
+
+void TestAnchorGraph::attachMatchesHandWired()
+{
+    AnchorGraph graph;
+    buildPage(&graph);
+
+    QWidget attachedWindow;
+    const QList<QWidget *> attached = createPage(&attachedWindow);
+    attached.first()->setGeometry(0, 0, 400, 300);
+    QVERIFY(graph.attach(attached));
+
+    QWidget wiredWindow;
+    const QList<QWidget *> wired = createPage(&wiredWindow);
+    wired.first()->setGeometry(0, 0, 400, 300);
+    AnchorLayout *pageLayout = AnchorLayout::get(wired.at(0));
+    AnchorLayout *headerLayout = AnchorLayout::get(wired.at(1));
+    AnchorLayout *bodyLayout = AnchorLayout::get(wired.at(2));
+    headerLayout->left()->anchorTo(pageLayout->left());
+    headerLayout->right()->anchorTo(pageLayout->right());
+    headerLayout->top()->anchorTo(pageLayout->top());
+    headerLayout->bottom()->anchorTo(
+            pageLayout->customLine(Qt::Horizontal, 0.1));
+    bodyLayout->fill(pageLayout);
+    bodyLayout->top()->anchorTo(headerLayout->bottom())->setMargin(5);
+
+    attachedWindow.show();
+    wiredWindow.show();
+    for (int i = 1; i < wired.size(); i++)
+        QTRY_COMPARE(attached.at(i)->geometry(), wired.at(i)->geometry());
+
+    attached.first()->resize(600, 500);
+    wired.first()->resize(600, 500);
+    for (int i = 1; i < wired.size(); i++)
+        QTRY_COMPARE(attached.at(i)->geometry(), wired.at(i)->geometry());
+}
+
+void TestAnchorGraph::attachRejectsMismatchedWidgets()
+{
+    AnchorGraph graph;
+    buildPage(&graph);
+
+    QWidget window;
+    const QList<QWidget *> page = createPage(&window);
+    QWidget *stranger = new QWidget(&window);
+
+    QVERIFY(!graph.attach(page.mid(0, 2)));
+    QVERIFY(!graph.attach(QList<QWidget *>()
+                          << page.at(0) << page.at(1) << nullptr));
+    QVERIFY(!graph.attach(QList<QWidget *>()
+                          << page.at(0) << page.at(1) << stranger));
+    QVERIFY(!graph.attach(QList<QWidget *>()
+                          << page.at(0) << page.at(1) << page.at(1)));
+
+    // Nothing was wired by the rejected attempts.
+    Q_FOREACH (QWidget *widget, page)
+        QVERIFY(!hasAnchorLayout(widget));
+    QVERIFY(!hasAnchorLayout(stranger));
+}
+
+void TestAnchorGraph::attachReusesExistingLayouts()
+{
+    AnchorGraph graph;
+    buildPage(&graph);
+
+    QWidget window;
+    window.resize(400, 300);
+    const QList<QWidget *> page = createPage(&window);
+    AnchorLayout *pageLayout = AnchorLayout::get(page.first());
+    pageLayout->fill(AnchorLayout::get(&window));
+    window.show();
+    QTRY_COMPARE(page.first()->geometry(), QRect(0, 0, 400, 300));
+
+    QVERIFY(graph.attach(page));
+    QCOMPARE(page.first()->findChildren<AnchorLayout *>(
+                     QString(), Qt::FindDirectChildrenOnly),
+             QList<AnchorLayout *>() << pageLayout);
+    QTRY_COMPARE(page.at(1)->geometry(), QRect(0, 0, 400, 31));
+
+    // The page still fills the window, and the graph follows it.
+    window.resize(600, 500);
+    QTRY_COMPARE(page.first()->geometry(), QRect(0, 0, 600, 500));
+    QTRY_COMPARE(page.at(1)->geometry(), QRect(0, 0, 600, 51));
+    QTRY_COMPARE(page.at(2)->geometry(), QRect(0, 55, 600, 445));
+}
+
+void TestAnchorGraph::attachRejectsConflicts()
+{
+    AnchorGraph graph;
+    buildPage(&graph);
+
+    // The header's left line is already anchored, and the graph anchors it
+    // too.
+    QWidget window;
+    const QList<QWidget *> page = createPage(&window);
+    AnchorLayout::get(page.at(1))->left()->anchorTo(
+            AnchorLayout::get(page.first())->horizontalCenter());
+    QVERIFY(!graph.attach(page));
+    QVERIFY(!hasAnchorLayout(page.at(2)));
+
+    // The same graph cannot be attached to the same widgets twice.
+    const QList<QWidget *> otherPage = createPage(&window);
+    QVERIFY(graph.attach(otherPage));
+    QVERIFY(!graph.attach(otherPage));
+}
+
+void TestAnchorGraph::fromJsonRejectsInvalidGraphs_data()
+{
+    AnchorGraph graph;
+    buildPage(&graph);
+    const QJsonObject json = graph.toJson();
+    const QJsonArray nodes = json.value("nodes").toArray();
+    const QJsonArray lines = json.value("lines").toArray();
+
+    QTest::addColumn<QJsonObject>("json");
+
+    // A node whose parent does not come before it.
+    QJsonArray badNodes = nodes;
+    QJsonObject node = badNodes.at(1).toObject();
+    node.insert("parent", 1);
+    badNodes.replace(1, node);
+    QJsonObject badJson = json;
+    badJson.insert("nodes", badNodes);
+    QTest::newRow("parent order") << badJson;
+
+    // A second left line for the same node.
+    QJsonArray badLines = lines;
+    QJsonObject line = lines.first().toObject();
+    line.insert("anchoredTo", -1);
+    badLines.append(line);
+    badJson = json;
+    badJson.insert("lines", badLines);
+    QTest::newRow("duplicate edge line") << badJson;
+
+    // An anchor to a line that does not exist.
+    badLines = lines;
+    line = lines.first().toObject();
+    line.insert("anchoredTo", lines.size());
+    badLines.replace(0, line);
+    badJson = json;
+    badJson.insert("lines", badLines);
+    QTest::newRow("invalid anchoredTo") << badJson;
+}
+
+void TestAnchorGraph::fromJsonRejectsInvalidGraphs()
+{
+    QFETCH(QJsonObject, json);
+
+    // A rejected graph leaves the existing one as it was.
+    AnchorGraph graph;
+    buildPage(&graph);
+    const QJsonObject before = graph.toJson();
+    QVERIFY(!graph.fromJson(json));
+    QCOMPARE(graph.toJson(), before);
+}
+
+QTEST_MAIN(TestAnchorGraph)
+#include "tst_anchorgraph.moc"
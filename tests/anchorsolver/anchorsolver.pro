@@ -0,0 +1,6 @@
+QT += widgets testlib
+CONFIG += testcase console
+CONFIG -= app_bundle
+INCLUDEPATH += ../..
+SOURCES = ../../anchorlayout.cpp tst_anchorsolver.cpp
+HEADERS = ../../anchorlayout.h
@@ -0,0 +1,255 @@
+/****************************************************************************
+**
+** Copyright 2020, Prashanth N Udupa <prashanth.udupa@gmail.com>
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain this copyright
+** notice, this list of conditions and the following disclaimer.
+**
+** 2. Redistributions in binary form must reproduce this copyright
+** notice, this list of conditions and the following disclaimer in the
+** documentation and/or other materials provided with the distribution.
+**
+** 3. Neither the name of the copyright holder nor the names of its
+** contributors may be used to endorse or promote products derived from
+** this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+** CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+** INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+** ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+** EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+****************************************************************************/
+
+#include "anchorlayout.h"
+#include <QtTest>
+#include <QtWidgets>
+
+class TestAnchorSolver : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void equalityAndInequality();
+    void unsatisfiableRequired();
+    void editKeepsPosition();
+    void removedAnchorKeepsGeometry();
+    void reparentedSibling();
+    void rejectedAnchorIsRetried();
+
+private:
+    QWidget *m_container = nullptr;
+    AnchorSolver *m_solver = nullptr;
+    AnchorLayout *m_containerLayout = nullptr;
+};
+
+void TestAnchorSolver::init()
+{
+    m_container = new QWidget;
+    m_container->resize(400, 300);
+    m_solver = AnchorSolver::get(m_container);
+    m_containerLayout = AnchorLayout::get(m_container);
+    m_container->show();
+    QVERIFY(QTest::qWaitForWindowExposed(m_container));
+}
+
+void TestAnchorSolver::cleanup()
+{
+    delete m_container;
+    m_container = nullptr;
+    m_solver = nullptr;
+    m_containerLayout = nullptr;
+}
+
+void TestAnchorSolver::equalityAndInequality()
+{
+    QWidget *frame = new QWidget(m_container);
+    frame->show();
+    AnchorLayout *frameLayout = AnchorLayout::get(frame);
+
+    // The frame starts 10 pixels in and would like to be 300 pixels wide,
+    // but must end at least 100 pixels before the container does.
+    frameLayout->left()->anchorTo(m_containerLayout->left())->setMargin(10);
+    QVERIFY(m_solver->addConstraint(frameLayout->right(),
+                                    AnchorSolver::LessOrEqual,
+                                    m_containerLayout->right(), -100)
+            >= 0);
+    QVERIFY(m_solver->addConstraint(frameLayout->right(), AnchorSolver::Equal,
+                                    frameLayout->left(), 299,
+                                    AnchorSolver::Strong)
+            >= 0);
+
+    QTRY_COMPARE(frame->geometry(),
+                 QRect(10, frame->y(), 290, frame->height()));
+
+    m_container->resize(600, 300);
+    QTRY_COMPARE(frame->geometry(),
+                 QRect(10, frame->y(), 300, frame->height()));
+
+    m_container->resize(300, 300);
+    QTRY_COMPARE(frame->geometry(),
+                 QRect(10, frame->y(), 190, frame->height()));
+}
+
+void TestAnchorSolver::unsatisfiableRequired()
+{
+    QWidget *frame = new QWidget(m_container);
+    frame->show();
+    AnchorLayout *frameLayout = AnchorLayout::get(frame);
+
+    frameLayout->left()->anchorTo(m_containerLayout->left())->setMargin(10);
+    QTRY_COMPARE(frame->x(), 10);
+
+    // Conflicts with the anchor, and must leave everything as it was.
+    QCOMPARE(m_solver->addConstraint(frameLayout->left(), AnchorSolver::Equal,
+                                     m_containerLayout->left(), 50),
+             -1);
+    QCOMPARE(m_solver->addConstraint(frameLayout->left(),
+                                     AnchorSolver::GreaterOrEqual,
+                                     m_containerLayout->left(), 20),
+             -1);
+    QTest::qWait(10);
+    QCOMPARE(frame->x(), 10);
+
+    const int constraint = m_solver->addConstraint(
+            frameLayout->right(), AnchorSolver::Equal,
+            m_containerLayout->right(), -20);
+    QVERIFY(constraint >= 0);
+    QTRY_COMPARE(frame->geometry(),
+                 QRect(10, frame->y(), 370, frame->height()));
+
+    QVERIFY(m_solver->removeConstraint(constraint));
+    QVERIFY(!m_solver->removeConstraint(constraint));
+    frameLayout->left()->setMargin(50);
+    QTRY_COMPARE(frame->geometry(),
+                 QRect(50, frame->y(), 370, frame->height()));
+}
+
+void TestAnchorSolver::editKeepsPosition()
+{
+    QWidget *leftFrame = new QWidget(m_container);
+    leftFrame->show();
+    QWidget *rightFrame = new QWidget(m_container);
+    rightFrame->show();
+
+    AnchorLayout *leftLayout = AnchorLayout::get(leftFrame);
+    AnchorLayout *rightLayout = AnchorLayout::get(rightFrame);
+    leftLayout->left()->anchorTo(m_containerLayout->left());
+    rightLayout->right()->anchorTo(m_containerLayout->right());
+    rightLayout->left()->anchorTo(leftLayout->right())->setMargin(5);
+
+    QVERIFY(m_solver->beginEdit(leftLayout->right()));
+    QVERIFY(!m_solver->beginEdit(leftLayout->right()));
+    QVERIFY(m_solver->suggestPosition(leftLayout->right(), 250));
+    QCOMPARE(leftFrame->geometry().right(), 250);
+    QCOMPARE(rightFrame->x(), 255);
+    QVERIFY(m_solver->suggestPosition(leftLayout->right(), 150));
+    QCOMPARE(leftFrame->geometry().right(), 150);
+    QCOMPARE(rightFrame->geometry(),
+             QRect(155, rightFrame->y(), 245, rightFrame->height()));
+    m_solver->endEdit(leftLayout->right());
+    QVERIFY(!m_solver->suggestPosition(leftLayout->right(), 100));
+
+    QTest::qWait(10);
+    QCOMPARE(leftFrame->geometry(),
+             QRect(0, leftFrame->y(), 151, leftFrame->height()));
+    QCOMPARE(rightFrame->geometry(),
+             QRect(155, rightFrame->y(), 245, rightFrame->height()));
+}
+
+void TestAnchorSolver::removedAnchorKeepsGeometry()
+{
+    QWidget *frame = new QWidget(m_container);
+    frame->show();
+    AnchorLayout *frameLayout = AnchorLayout::get(frame);
+
+    frameLayout->left()->anchorTo(m_containerLayout->left())->setMargin(10);
+    frameLayout->right()->anchorTo(m_containerLayout->right())->setMargin(10);
+    QTRY_COMPARE(frame->geometry(),
+                 QRect(10, frame->y(), 380, frame->height()));
+
+    frameLayout->right()->anchorTo(nullptr);
+    QTest::qWait(10);
+    QCOMPARE(frame->geometry(), QRect(10, frame->y(), 380, frame->height()));
+}
+
+void TestAnchorSolver::reparentedSibling()
+{
+    QWidget *frame1 = new QWidget(m_container);
+    frame1->setGeometry(0, 0, 100, 50);
+    frame1->show();
+    QWidget *frame2 = new QWidget(m_container);
+    frame2->show();
+
+    AnchorLayout *frame1Layout = AnchorLayout::get(frame1);
+    AnchorLayout *frame2Layout = AnchorLayout::get(frame2);
+    frame1Layout->left()->anchorTo(m_containerLayout->left())->setMargin(10);
+    frame2Layout->left()->anchorTo(frame1Layout->right())->setMargin(5);
+    QTRY_COMPARE(frame2->x(), 114);
+
+    // The sibling's anchor follows frame1 out of the container and back.
+    frame1->setParent(nullptr);
+    QTest::qWait(10);
+    QCOMPARE(frame2->x(), 114);
+
+    frame1->setParent(m_container);
+    frame1->show();
+    frame1Layout->left()->setMargin(30);
+    QTRY_COMPARE(frame1->x(), 30);
+    QTRY_COMPARE(frame2->x(), 134);
+}
+
+void TestAnchorSolver::rejectedAnchorIsRetried()
+{
+    QWidget *frame = new QWidget(m_container);
+    frame->show();
+    AnchorLayout *frameLayout = AnchorLayout::get(frame);
+
+    int constraint = m_solver->addConstraint(
+            frameLayout->left(), AnchorSolver::Equal, m_containerLayout->left(),
+            50);
+    QVERIFY(constraint >= 0);
+    QTRY_COMPARE(frame->x(), 50);
+
+    // The anchor conflicts with the constraint, so it waits until the
+    // constraint is removed.
+    QTest::ignoreMessage(QtWarningMsg,
+                         QRegularExpression("cannot honour the anchor"));
+    frameLayout->left()->anchorTo(m_containerLayout->left())->setMargin(10);
+    QTest::qWait(10);
+    QCOMPARE(frame->x(), 50);
+
+    QVERIFY(m_solver->removeConstraint(constraint));
+    QTRY_COMPARE(frame->x(), 10);
+
+    // Same when changing the offset makes the anchor inconsistent.
+    constraint = m_solver->addConstraint(frameLayout->left(),
+                                         AnchorSolver::Equal,
+                                         m_containerLayout->left(), 10);
+    QVERIFY(constraint >= 0);
+    QTest::ignoreMessage(QtWarningMsg,
+                         QRegularExpression("cannot honour the anchor"));
+    frameLayout->left()->setMargin(20);
+    QTest::qWait(10);
+    QCOMPARE(frame->x(), 10);
+
+    QVERIFY(m_solver->removeConstraint(constraint));
+    QTRY_COMPARE(frame->x(), 20);
+}
+
+QTEST_MAIN(TestAnchorSolver)
+#include "tst_anchorsolver.moc"
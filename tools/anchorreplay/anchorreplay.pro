@@ -0,0 +1,6 @@
+QT += widgets
+CONFIG += console
+CONFIG -= app_bundle
+INCLUDEPATH += ../..
+SOURCES = ../../anchorlayout.cpp main.cpp
+HEADERS = ../../anchorlayout.h
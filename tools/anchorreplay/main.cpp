@@ -0,0 +1,246 @@
+/****************************************************************************
+**
+** Copyright 2020, Prashanth N Udupa <prashanth.udupa@gmail.com>
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain this copyright
+** notice, this list of conditions and the following disclaimer.
+**
+** 2. Redistributions in binary form must reproduce this copyright
+** notice, this list of conditions and the following disclaimer in the
+** documentation and/or other materials provided with the distribution.
+**
+** 3. Neither the name of the copyright holder nor the names of its
+** contributors may be used to endorse or promote products derived from
+** this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+** CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+** INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+** ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+** EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+****************************************************************************/
+
+#include "anchorlayout.h"
+#include <QtWidgets>
+
+#include <cstdio>
+
+/*
+ * Replays a trace saved by AnchorRecorder. The recorded widgets are rebuilt
+ * as plain QWidgets, the anchor graph is attached to them, and the recorded
+ * external geometry changes are applied one after the other, as fast as the
+ * anchor layouts settle. Recorded timestamps are not used for pacing, so
+ * that replays are repeatable.
+ */
+
+// Counts the geometry changes of the watched widgets. A setGeometry() that
+// both moves and resizes a widget sends a move and a resize event, but is
+// counted once, by comparing against the last geometry seen.
+class GeometryCounter : public QObject
+{
+public:
+    int changes = 0;
+
+    void watch(QWidget *widget)
+    {
+        m_geometries.insert(widget, widget->geometry());
+        widget->installEventFilter(this);
+    }
+
+    // Geometry changes that the replay makes itself are not counted.
+    void expect(const QWidget *widget, const QRect &geometry)
+    {
+        m_geometries.insert(widget, geometry);
+    }
+
+protected:
+    bool eventFilter(QObject *object, QEvent *event)
+    {
+        if (event->type() == QEvent::Move
+            || event->type() == QEvent::Resize) {
+            const QWidget *widget = static_cast<QWidget *>(object);
+            QRect &geometry = m_geometries[widget];
+            if (geometry != widget->geometry()) {
+                geometry = widget->geometry();
+                ++changes;
+            }
+        }
+        return false;
+    }
+
+private:
+    QHash<const QWidget *, QRect> m_geometries;
+};
+
+static QRect rectFromJson(const QJsonValue &value)
+{
+    const QJsonArray array = value.toArray();
+    return QRect(array.at(0).toInt(), array.at(1).toInt(), array.at(2).toInt(),
+                 array.at(3).toInt());
+}
+
+// Anchor layouts update on zero-timers, and each update can schedule more, so
+// events are processed until a few passes in a row cause no geometry change.
+// Anchors that keep moving widgets around never settle, so the number of
+// passes is bounded.
+static bool settle(const GeometryCounter &counter)
+{
+    int quietPasses = 0;
+    for (int pass = 0; pass < 1000; pass++) {
+        const int before = counter.changes;
+        QCoreApplication::processEvents();
+        quietPasses = (counter.changes == before) ? quietPasses + 1 : 0;
+        if (quietPasses == 3)
+            return true;
+    }
+
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays an AnchorRecorder trace.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("trace", "Trace file to replay.");
+    QCommandLineOption repeatOption("repeat", "Replay the trace <n> times.",
+                                    "n", "1");
+    parser.addOption(repeatOption);
+    parser.process(a);
+
+    const QStringList args = parser.positionalArguments();
+    if (args.size() != 1)
+        parser.showHelp(1);
+
+    QFile file(args.first());
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Cannot open" << file.fileName() << file.errorString();
+        return 1;
+    }
+
+    QJsonParseError error;
+    const QJsonObject trace =
+            QJsonDocument::fromJson(file.readAll(), &error).object();
+    if (error.error != QJsonParseError::NoError) {
+        qWarning() << "Cannot parse" << file.fileName() << error.errorString();
+        return 1;
+    }
+
+    AnchorGraph graph;
+    if (!graph.fromJson(trace.value("graph").toObject())) {
+        qWarning() << "Invalid anchor graph in" << file.fileName();
+        return 1;
+    }
+
+    const QJsonArray geometries = trace.value("geometries").toArray();
+    const QJsonArray events = trace.value("events").toArray();
+    if (geometries.size() != graph.nodeCount()) {
+        qWarning() << "Node geometries do not match the anchor graph in"
+                   << file.fileName();
+        return 1;
+    }
+
+    GeometryCounter counter;
+    QList<QWidget *> widgets;
+    for (int i = 0; i < graph.nodeCount(); i++) {
+        const int parent = graph.parentNode(i);
+        QWidget *widget =
+                new QWidget(parent < 0 ? nullptr : widgets.at(parent));
+        widget->setGeometry(rectFromJson(geometries.at(i)));
+        counter.watch(widget);
+        widgets.append(widget);
+    }
+
+    if (!graph.attach(widgets)) {
+        qWarning() << "Cannot attach the anchor graph in" << file.fileName();
+        return 1;
+    }
+
+    Q_FOREACH (QWidget *widget, widgets) {
+        if (widget->parentWidget() == nullptr)
+            widget->show();
+    }
+    if (!settle(counter)) {
+        qWarning() << "The anchor layouts did not settle after attaching";
+        return 1;
+    }
+
+    for (int i = 0; i < events.size(); i++) {
+        const int node = events.at(i).toObject().value("node").toInt(-1);
+        if (node < 0 || node >= widgets.size()) {
+            qWarning() << "Invalid node in event" << i;
+            return 1;
+        }
+    }
+
+    const int repeat = qMax(parser.value(repeatOption).toInt(), 1);
+    counter.changes = 0;
+
+    int replayedChanges = 0;
+    qint64 slowest = 0;
+    QElapsedTimer total;
+    total.start();
+    for (int r = 0; r < repeat; r++) {
+        for (int i = 0; i < events.size(); i++) {
+            const QJsonObject event = events.at(i).toObject();
+            QWidget *widget = widgets.at(event.value("node").toInt());
+            const QRect geometry = rectFromJson(event.value("geometry"));
+
+            QElapsedTimer timer;
+            timer.start();
+            if (widget->geometry() != geometry)
+                ++replayedChanges;
+            counter.expect(widget, geometry);
+            widget->setGeometry(geometry);
+            if (!settle(counter)) {
+                qWarning() << "The anchor layouts did not settle after event"
+                           << i;
+                return 1;
+            }
+            slowest = qMax(slowest, timer.nsecsElapsed());
+        }
+    }
+    const qint64 elapsed = total.nsecsElapsed();
+
+    const int replayed = events.size() * repeat;
+    const qint64 recorded = events.isEmpty()
+            ? 0
+            : qint64(events.at(events.size() - 1)
+                             .toObject()
+                             .value("time")
+                             .toDouble());
+
+    std::printf("nodes:            %d\n", graph.nodeCount());
+    std::printf("events:           %d x %d\n", int(events.size()), repeat);
+    std::printf("recorded session: %lld ms\n", recorded);
+    std::printf("replay time:      %.3f ms\n", elapsed / 1e6);
+    std::printf("per event:        %.3f ms\n",
+                replayed ? elapsed / 1e6 / replayed : 0.0);
+    std::printf("slowest event:    %.3f ms\n", slowest / 1e6);
+    std::printf("replayed changes: %d\n", replayedChanges);
+    std::printf("layout changes:   %d\n", counter.changes);
+
+    Q_FOREACH (QWidget *widget, widgets) {
+        if (widget->parentWidget() == nullptr)
+            delete widget;
+    }
+
+    return 0;
+}